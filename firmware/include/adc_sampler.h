@@ -0,0 +1,253 @@
+#ifndef ADC_SAMPLER_H
+#define ADC_SAMPLER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <math.h>
+#include <esp_timer.h>
+#include <driver/i2s.h>
+#include <driver/adc.h>
+#include <esp_adc_cal.h>
+#include "gpio_tools.h"
+
+#define ADC_I2S_PORT I2S_NUM_0        // Only I2S0 can be fed by the ADC
+#define ADC_DMA_BUFFERS 4             // DMA descriptor ring
+#define ADC_DMA_BUFFER_LEN 512        // Samples per DMA buffer
+#define ADC_SAMPLES_DEFAULT 2048
+#define ADC_SAMPLES_MAX 16384
+#define ADC_RATE_DEFAULT 10000
+#define ADC_RATE_MIN 1000
+#define ADC_RATE_MAX 100000
+#define ADC_FFT_SIZE 256              // Power of two; the first samples of the capture
+#define ADC_FFT_BITS 8
+
+// Samples an ADC1 pin at a fixed rate with the I2S peripheral in built-in ADC
+// mode: conversions land in a ring of DMA buffers with no CPU involvement,
+// and each buffer is folded into running min/max/sum/sum-of-squares as it
+// arrives, so a capture of any length needs only one buffer of RAM. Only a
+// compact summary leaves the device; raw samples never reach the prompt.
+//
+// With fft, the first ADC_FFT_SIZE samples also go through a Hann-windowed
+// Q15 fixed-point FFT and the strongest non-DC bin is reported (vibration,
+// mains hum on a current sensor). ADC1 only (GPIO 32-39), as ADC2 is taken
+// by WiFi.
+class AdcSampler {
+public:
+    // Returns {"pin", "samples", "rate_hz", "min_mv", "max_mv", "mean_mv",
+    // "rms_mv", "ac_rms_mv"[, "fft": {"peak_hz", "peak_mv", "bin_hz"}]}.
+    // rate_hz is the rate measured over the capture, not the one requested.
+    static String sample(int pin, long samples, long rateHz, bool fft) {
+        adc1_channel_t channel;
+        if (!channelFor(pin, channel)) return "Error: Pin " + String(pin) + " is not an ADC1 input (32-39)";
+        if (samples < 1 || samples > ADC_SAMPLES_MAX) return "Error: samples must be 1-" + String(ADC_SAMPLES_MAX);
+        if (rateHz < ADC_RATE_MIN || rateHz > ADC_RATE_MAX) {
+            return "Error: rate_hz must be " + String(ADC_RATE_MIN) + "-" + String(ADC_RATE_MAX);
+        }
+        if (fft && samples < ADC_FFT_SIZE) return "Error: fft needs at least " + String(ADC_FFT_SIZE) + " samples";
+
+        xSemaphoreTake(lock(), portMAX_DELAY);
+        if (!start(pin, channel, rateHz)) {
+            xSemaphoreGive(lock());
+            return "Error: ADC sampler unavailable";
+        }
+
+        static uint16_t chunk[ADC_DMA_BUFFER_LEN];
+        static int16_t re[ADC_FFT_SIZE];
+        static int16_t im[ADC_FFT_SIZE];
+        const esp_adc_cal_characteristics_t* cal = calibration();
+        TickType_t timeout = pdMS_TO_TICKS(ADC_DMA_BUFFER_LEN * 1000L / rateHz + 100);
+        size_t bytes = 0;
+
+        // The first buffer holds conversions from before the channel settled
+        bool ok = i2s_read(ADC_I2S_PORT, chunk, sizeof(chunk), &bytes, timeout) == ESP_OK && bytes > 0;
+        int64_t startUs = esp_timer_get_time();
+        uint32_t minMv = UINT32_MAX, maxMv = 0, sum = 0;
+        uint64_t sumSquares = 0;
+        long taken = 0;
+        while (ok && taken < samples) {
+            ok = i2s_read(ADC_I2S_PORT, chunk, sizeof(chunk), &bytes, timeout) == ESP_OK && bytes > 0;
+            size_t n = bytes / sizeof(uint16_t);
+            for (size_t i = 0; ok && i < n && taken < samples; i++, taken++) {
+                // 16-bit ADC words arrive with each pair swapped; the top 4 bits are the channel
+                uint32_t mv = esp_adc_cal_raw_to_voltage(chunk[(i ^ 1) < n ? i ^ 1 : i] & 0x0FFF, cal);
+                if (mv < minMv) minMv = mv;
+                if (mv > maxMv) maxMv = mv;
+                sum += mv;
+                sumSquares += (uint64_t)mv * mv;
+                if (fft && taken < ADC_FFT_SIZE) re[taken] = (int16_t)mv;
+            }
+        }
+        int64_t elapsedUs = esp_timer_get_time() - startUs;
+        stop();
+        if (!ok) {
+            xSemaphoreGive(lock());
+            return "Error: ADC read timed out";
+        }
+
+        float mean = (float)sum / taken;
+        float meanSquare = (float)sumSquares / taken;
+        float measuredRate = elapsedUs > 0 ? taken * 1000000.0f / elapsedUs : (float)rateHz;
+        DynamicJsonDocument doc(384);
+        doc["pin"] = pin;
+        doc["samples"] = taken;
+        doc["rate_hz"] = (uint32_t)(measuredRate + 0.5f);
+        doc["min_mv"] = minMv;
+        doc["max_mv"] = maxMv;
+        doc["mean_mv"] = round1(mean);
+        doc["rms_mv"] = round1(sqrtf(meanSquare));
+        doc["ac_rms_mv"] = round1(sqrtf(fmaxf(meanSquare - mean * mean, 0.0f)));
+        if (fft) {
+            float peakMv;
+            int bin = fftPeak(re, im, (int16_t)(mean + 0.5f), peakMv);
+            JsonObject f = doc.createNestedObject("fft");
+            f["peak_hz"] = round1(bin * measuredRate / ADC_FFT_SIZE);
+            f["peak_mv"] = round1(peakMv);
+            f["bin_hz"] = round1(measuredRate / ADC_FFT_SIZE);
+        }
+        xSemaphoreGive(lock());
+
+        String output;
+        serializeJson(doc, output);
+        return output;
+    }
+
+private:
+    static SemaphoreHandle_t lock() {
+        static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+        return mutex;
+    }
+
+    static float round1(float v) {
+        return roundf(v * 10.0f) / 10.0f;
+    }
+
+    static bool channelFor(int pin, adc1_channel_t& channel) {
+        switch (pin) {
+            case 36: channel = ADC1_CHANNEL_0; return true;
+            case 39: channel = ADC1_CHANNEL_3; return true;
+            case 32: channel = ADC1_CHANNEL_4; return true;
+            case 33: channel = ADC1_CHANNEL_5; return true;
+            case 34: channel = ADC1_CHANNEL_6; return true;
+            case 35: channel = ADC1_CHANNEL_7; return true;
+            default: return false;
+        }
+    }
+
+    // eFuse calibration for the full-range (11 dB) setting, read once
+    static const esp_adc_cal_characteristics_t* calibration() {
+        static esp_adc_cal_characteristics_t chars;
+        static bool done = false;
+        if (!done) {
+            esp_adc_cal_characterize(ADC_UNIT_1, ADC_ATTEN_DB_11, ADC_WIDTH_BIT_12, 1100, &chars);
+            done = true;
+        }
+        return &chars;
+    }
+
+    // Installs I2S0 in ADC mode for this capture; stop() releases it again
+    static bool start(int pin, adc1_channel_t channel, long rateHz) {
+        i2s_config_t cfg = {};
+        cfg.mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX | I2S_MODE_ADC_BUILT_IN);
+        cfg.sample_rate = rateHz;
+        cfg.bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT;
+        cfg.channel_format = I2S_CHANNEL_FMT_ONLY_LEFT;
+        cfg.communication_format = I2S_COMM_FORMAT_STAND_I2S;
+        cfg.dma_buf_count = ADC_DMA_BUFFERS;
+        cfg.dma_buf_len = ADC_DMA_BUFFER_LEN;
+        cfg.use_apll = false;
+        if (i2s_driver_install(ADC_I2S_PORT, &cfg, 0, nullptr) != ESP_OK) return false;
+        GpioTools::invalidatePin(pin); // The pad becomes an analog input
+        adc1_config_width(ADC_WIDTH_BIT_12);
+        adc1_config_channel_atten(channel, ADC_ATTEN_DB_11);
+        if (i2s_set_adc_mode(ADC_UNIT_1, channel) != ESP_OK || i2s_adc_enable(ADC_I2S_PORT) != ESP_OK) {
+            i2s_driver_uninstall(ADC_I2S_PORT);
+            return false;
+        }
+        return true;
+    }
+
+    static void stop() {
+        i2s_adc_disable(ADC_I2S_PORT);
+        i2s_driver_uninstall(ADC_I2S_PORT);
+    }
+
+    // Q15 twiddles (cos, sin of 2*pi*k/N) and Hann window, built on first use
+    struct FftTables {
+        int16_t cos[ADC_FFT_SIZE / 2];
+        int16_t sin[ADC_FFT_SIZE / 2];
+        int16_t window[ADC_FFT_SIZE];
+    };
+
+    static const FftTables& tables() {
+        static FftTables t;
+        static bool built = false;
+        if (!built) {
+            for (int k = 0; k < ADC_FFT_SIZE / 2; k++) {
+                t.cos[k] = (int16_t)lroundf(32767.0f * cosf(2.0f * PI * k / ADC_FFT_SIZE));
+                t.sin[k] = (int16_t)lroundf(32767.0f * sinf(2.0f * PI * k / ADC_FFT_SIZE));
+            }
+            for (int i = 0; i < ADC_FFT_SIZE; i++) {
+                t.window[i] = (int16_t)lroundf(32767.0f * 0.5f * (1.0f - cosf(2.0f * PI * i / (ADC_FFT_SIZE - 1))));
+            }
+            built = true;
+        }
+        return t;
+    }
+
+    // In-place radix-2 FFT on millivolt samples in re. The mean is removed
+    // and the signal scaled by 8 to use the Q15 range; every stage halves
+    // the values so nothing overflows, which leaves X[k] / N. For a sine of
+    // amplitude A that is 8 * A * 0.5 (Hann gain) / 2 = 2A at its bin.
+    // Returns the strongest bin above DC and its amplitude in mV.
+    static int fftPeak(int16_t* re, int16_t* im, int16_t mean, float& peakMv) {
+        const FftTables& t = tables();
+        for (int i = 0; i < ADC_FFT_SIZE; i++) {
+            int32_t v = ((int32_t)(re[i] - mean) * 8 * t.window[i]) >> 15;
+            re[i] = (int16_t)constrain(v, -32768, 32767);
+            im[i] = 0;
+        }
+
+        // Bit-reversed order, then butterflies
+        for (int i = 0; i < ADC_FFT_SIZE; i++) {
+            int j = 0;
+            for (int b = 0; b < ADC_FFT_BITS; b++) j |= ((i >> b) & 1) << (ADC_FFT_BITS - 1 - b);
+            if (j > i) {
+                int16_t tmp = re[i];
+                re[i] = re[j];
+                re[j] = tmp;
+            }
+        }
+        for (int len = 2; len <= ADC_FFT_SIZE; len <<= 1) {
+            int half = len / 2;
+            int step = ADC_FFT_SIZE / len;
+            for (int i = 0; i < ADC_FFT_SIZE; i += len) {
+                for (int j = 0; j < half; j++) {
+                    int32_t wr = t.cos[j * step];
+                    int32_t wi = -t.sin[j * step];
+                    int a = i + j, b = a + half;
+                    int32_t tr = (wr * re[b] - wi * im[b]) >> 15;
+                    int32_t ti = (wr * im[b] + wi * re[b]) >> 15;
+                    int32_t ur = re[a], ui = im[a];
+                    re[a] = (int16_t)((ur + tr) >> 1);
+                    im[a] = (int16_t)((ui + ti) >> 1);
+                    re[b] = (int16_t)((ur - tr) >> 1);
+                    im[b] = (int16_t)((ui - ti) >> 1);
+                }
+            }
+        }
+
+        int peak = 1;
+        uint32_t peakPower = 0;
+        for (int k = 1; k < ADC_FFT_SIZE / 2; k++) {
+            uint32_t power = (uint32_t)((int32_t)re[k] * re[k]) + (uint32_t)((int32_t)im[k] * im[k]);
+            if (power > peakPower) {
+                peakPower = power;
+                peak = k;
+            }
+        }
+        peakMv = sqrtf((float)peakPower) / 2.0f;
+        return peak;
+    }
+};
+
+#endif
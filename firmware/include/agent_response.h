@@ -0,0 +1,84 @@
+#ifndef AGENT_RESPONSE_H
+#define AGENT_RESPONSE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+#define RESPONSE_BYTES_PER_TOKEN 4
+#define RESPONSE_DOC_OVERHEAD 1536   // Nodes and short strings around the reply
+
+// Document size for a filtered provider response whose output is capped at
+// maxTokens: only the reply and tool calls are kept, so this does not grow
+// with metadata, reasoning or safety ratings.
+inline size_t responseDocCapacity(int maxTokens) {
+    return (size_t)maxTokens * RESPONSE_BYTES_PER_TOKEN + RESPONSE_DOC_OVERHEAD;
+}
+
+// Outcome of one agent turn. Provider clients fill it in, the router and
+// handleAgentRequest pass it along as a value, and only the frontend
+// serializes it (once) for the web UI or Telegram.
+struct AgentResponse {
+    String error;       // Provider failure; nothing else is set
+    String thought;
+    String reply;
+    String tool;        // Tools that ran this turn, comma-joined ("" for none)
+    String toolResult;
+    DynamicJsonDocument callDoc; // Requested tool calls: {"calls": [{"tool", "args"}]}
+
+    AgentResponse() : callDoc(0) {}
+
+    static AgentResponse failure(const String& message) {
+        AgentResponse response;
+        response.error = message;
+        return response;
+    }
+
+    bool failed() const { return error.length() > 0; }
+
+    // The requested tool calls; args stay views into callDoc
+    JsonArray calls() { return callDoc["calls"]; }
+
+    // Starts an empty call list with room for `capacity` bytes of calls
+    JsonArray beginCalls(size_t capacity) {
+        callDoc = DynamicJsonDocument(capacity);
+        return callDoc.createNestedArray("calls");
+    }
+
+    // Reads the {"thought","tool","args","reply"} object the prompt asks for
+    // in text tool mode; several calls may come as "calls": [{tool, args}]
+    void parse(const char* json) {
+        callDoc = DynamicJsonDocument(strlen(json) * 2 + 1024);
+        if (deserializeJson(callDoc, json) || !callDoc.is<JsonObject>()) {
+            callDoc.clear();
+            reply = String("Error parsing my own thought: ") + json;
+            return;
+        }
+        thought = callDoc["thought"] | "";
+        reply = callDoc["reply"] | "";
+
+        JsonArray list = callDoc["calls"].is<JsonArray>() ? callDoc["calls"].as<JsonArray>()
+                                                           : callDoc.createNestedArray("calls");
+        const char* single = callDoc["tool"];
+        if (list.size() == 0 && single && strcmp(single, "none") != 0) {
+            JsonObject call = list.createNestedObject();
+            call["tool"] = String(single); // Owned, so copies of the response stay valid
+            call["args"] = callDoc["args"];
+        }
+    }
+
+    // {"reply","thought","tool","tool_result"}: the shape the web UI reads.
+    // Strings are referenced, not copied, so the document only holds nodes.
+    String toJson() const {
+        StaticJsonDocument<192> doc;
+        doc["reply"] = reply.c_str();
+        doc["thought"] = thought.c_str();
+        doc["tool"] = tool.c_str();
+        doc["tool_result"] = toolResult.c_str();
+        String output;
+        output.reserve(reply.length() + thought.length() + tool.length() + toolResult.length() * 2 + 64);
+        serializeJson(doc, output);
+        return output;
+    }
+};
+
+#endif
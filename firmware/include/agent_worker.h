@@ -0,0 +1,213 @@
+#ifndef AGENT_WORKER_H
+#define AGENT_WORKER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <functional>
+#include "sse_parser.h"
+
+#define AGENT_JOB_SLOTS 6           // Queued + running + finished-but-not-collected
+#define AGENT_QUEUE_DEPTH 4
+#define AGENT_JOB_TTL_MS 120000     // Finished web jobs nobody polls are dropped after this
+#define AGENT_WORKER_STACK 16384    // TLS handshakes and JSON parsing run on this stack
+#define AGENT_WORKER_PRIORITY 1
+#define AGENT_WORKER_CORE 1
+
+// One agent request, from the web UI or Telegram
+struct AgentJob {
+    enum Source { WEB, TELEGRAM };
+    enum Status { FREE, QUEUED, RUNNING, DONE };
+
+    uint32_t id = 0;
+    Source source = WEB;
+    Status status = FREE;
+    String body;        // Web: request JSON (parsed in place). Telegram: message text
+    String chatId;      // Telegram only
+    String partial;     // Reply text streamed so far
+    uint8_t resets = 0; // Times partial was discarded for another provider's answer
+    String result;      // Final JSON once DONE
+    unsigned long finishedAt = 0;
+};
+
+// Runs agent requests on a dedicated FreeRTOS task so loop() keeps serving the
+// CLI, web UI and Telegram while an LLM call is in flight. Requests wait in a
+// bounded queue; web clients poll their job by id, Telegram replies are
+// collected by loop() once finished.
+class AgentWorker {
+public:
+    // Runs one job on the worker task; tokens are reported as they stream in
+    typedef std::function<String(AgentJob&, TokenCallback)> Processor;
+
+    bool begin(Processor processor) {
+        _processor = processor;
+        _lock = xSemaphoreCreateMutex();
+        _queue = xQueueCreate(AGENT_QUEUE_DEPTH, sizeof(uint8_t));
+        if (!_lock || !_queue) return false;
+        return xTaskCreatePinnedToCore(taskEntry, "agent", AGENT_WORKER_STACK, this,
+                                       AGENT_WORKER_PRIORITY, nullptr, AGENT_WORKER_CORE) == pdPASS;
+    }
+
+    // Queues a request. Returns its job id, or 0 if the queue is full.
+    uint32_t submit(AgentJob::Source source, const String& body, const String& chatId = "") {
+        if (!_queue) return 0;
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        expire();
+        int slot = -1;
+        for (int i = 0; i < AGENT_JOB_SLOTS; i++) {
+            if (_jobs[i].status == AgentJob::FREE) { slot = i; break; }
+        }
+        uint32_t id = 0;
+        if (slot >= 0) {
+            AgentJob& job = _jobs[slot];
+            id = job.id = ++_nextId;
+            job.source = source;
+            job.body = body;
+            job.chatId = chatId;
+            job.partial = "";
+            job.resets = 0;
+            job.result = "";
+            job.status = AgentJob::QUEUED;
+            uint8_t index = slot;
+            if (xQueueSend(_queue, &index, 0) != pdTRUE) {
+                job.status = AgentJob::FREE;
+                id = 0;
+            }
+        }
+        xSemaphoreGive(_lock);
+        return id;
+    }
+
+    // Writes a web job's state as JSON: status, reply text streamed since
+    // byte offset `since` (offsets start over whenever "resets" changes), and
+    // the final result once done (the job is then released). Returns false
+    // for an unknown or expired id.
+    bool poll(uint32_t id, size_t since, String& out) {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        AgentJob* job = find(id);
+        if (!job) {
+            xSemaphoreGive(_lock);
+            return false;
+        }
+
+        DynamicJsonDocument doc(512 + job->partial.length() + job->result.length());
+        doc["id"] = job->id;
+        doc["status"] = statusName(job->status);
+        doc["queued"] = queuedAhead(job);
+        if (since < job->partial.length()) doc["tokens"] = job->partial.c_str() + since;
+        doc["offset"] = job->partial.length();
+        doc["resets"] = job->resets;
+        if (job->status == AgentJob::DONE) doc["result"] = serialized(job->result);
+        serializeJson(doc, out);
+
+        if (job->status == AgentJob::DONE) release(job);
+        xSemaphoreGive(_lock);
+        return true;
+    }
+
+    // Hands a finished Telegram job to the caller (loop) and frees its slot
+    bool takeTelegramReply(String& chatId, String& reply) {
+        bool found = false;
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        for (AgentJob& job : _jobs) {
+            if (job.status == AgentJob::DONE && job.source == AgentJob::TELEGRAM) {
+                chatId = job.chatId;
+                reply = job.result;
+                release(&job);
+                found = true;
+                break;
+            }
+        }
+        xSemaphoreGive(_lock);
+        return found;
+    }
+
+private:
+    AgentJob _jobs[AGENT_JOB_SLOTS];
+    Processor _processor;
+    SemaphoreHandle_t _lock = nullptr;
+    QueueHandle_t _queue = nullptr;
+    uint32_t _nextId = 0;
+
+    static void taskEntry(void* arg) {
+        static_cast<AgentWorker*>(arg)->run();
+    }
+
+    void run() {
+        uint8_t index;
+        for (;;) {
+            if (xQueueReceive(_queue, &index, portMAX_DELAY) != pdTRUE) continue;
+            AgentJob& job = _jobs[index];
+
+            xSemaphoreTake(_lock, portMAX_DELAY);
+            job.status = AgentJob::RUNNING;
+            xSemaphoreGive(_lock);
+
+            // Only this task touches body while RUNNING; partial is shared with poll()
+            String result = _processor(job, [this, &job](const char* token) {
+                xSemaphoreTake(_lock, portMAX_DELAY);
+                if (token) {
+                    job.partial += token;
+                } else {
+                    job.partial = "";
+                    job.resets++;
+                }
+                xSemaphoreGive(_lock);
+            });
+
+            xSemaphoreTake(_lock, portMAX_DELAY);
+            job.result = result;
+            job.body = String(); // Free the request copy early
+            job.finishedAt = millis();
+            job.status = AgentJob::DONE;
+            xSemaphoreGive(_lock);
+        }
+    }
+
+    // Caller holds _lock
+    AgentJob* find(uint32_t id) {
+        for (AgentJob& job : _jobs) {
+            if (job.status != AgentJob::FREE && job.id == id) return &job;
+        }
+        return nullptr;
+    }
+
+    int queuedAhead(const AgentJob* job) const {
+        if (job->status != AgentJob::QUEUED) return 0;
+        int ahead = 0;
+        for (const AgentJob& other : _jobs) {
+            if (other.status == AgentJob::RUNNING ||
+                (other.status == AgentJob::QUEUED && other.id < job->id)) ahead++;
+        }
+        return ahead;
+    }
+
+    void release(AgentJob* job) {
+        job->status = AgentJob::FREE;
+        job->body = String();
+        job->partial = String();
+        job->result = String();
+    }
+
+    // Drops finished web jobs whose client went away
+    void expire() {
+        for (AgentJob& job : _jobs) {
+            if (job.status == AgentJob::DONE && job.source == AgentJob::WEB &&
+                millis() - job.finishedAt > AGENT_JOB_TTL_MS) {
+                release(&job);
+            }
+        }
+    }
+
+    static const char* statusName(AgentJob::Status status) {
+        switch (status) {
+            case AgentJob::QUEUED: return "queued";
+            case AgentJob::RUNNING: return "running";
+            case AgentJob::DONE: return "done";
+            default: return "free";
+        }
+    }
+};
+
+extern AgentWorker agentWorker;
+
+#endif
@@ -3,6 +3,13 @@
 
 #include "common.h"
 #include "config_manager.h"
+#include "http_pool.h"
+#include "memory_store.h"
+#include "memory_index.h"
+#include "intent_matcher.h"
+#include "provider_router.h"
+#include "script_manager.h"
+#include "script_library.h"
 
 class CLI {
 public:
@@ -134,6 +141,63 @@ private:
             } else {
                 Serial.println("Usage: set_provider <gemini|groq>");
             }
+        } else if (command == "set_groq_url") {
+            // Empty argument restores the public endpoint
+            config.groq_url = argCount >= 1 ? args[0] : "";
+            config.save();
+            Serial.println("Groq URL set to " + (config.groq_url.length() ? config.groq_url : String("default")) + ". Restart to apply.");
+        } else if (command == "set_gemini_url") {
+            // Base up to "models/"; empty restores the public endpoint
+            config.gemini_url = argCount >= 1 ? args[0] : "";
+            config.save();
+            Serial.println("Gemini URL set to " + (config.gemini_url.length() ? config.gemini_url : String("default")) + ". Restart to apply.");
+        } else if (command == "set_hedging") {
+            if (argCount >= 1 && (args[0] == "on" || args[0] == "off")) {
+                config.hedge_requests = (args[0] == "on");
+                config.save();
+                router.setHedging(config.hedge_requests);
+                Serial.println(String("Provider hedging ") + (config.hedge_requests ? "enabled" : "disabled"));
+            } else {
+                Serial.println("Usage: set_hedging <on|off>");
+            }
+        } else if (command == "provider_stats") {
+            Serial.println(router.statsJson());
+        } else if (command == "set_stream") {
+            if (argCount >= 1 && (args[0] == "on" || args[0] == "off")) {
+                config.stream_replies = (args[0] == "on");
+                config.save();
+                Serial.println(String("Streaming ") + (config.stream_replies ? "enabled" : "disabled"));
+            } else {
+                Serial.println("Usage: set_stream <on|off>");
+            }
+        } else if (command == "set_native_tools") {
+            if (argCount >= 1 && (args[0] == "on" || args[0] == "off")) {
+                config.native_tools = (args[0] == "on");
+                config.save();
+                Serial.println(String("Groq native tools ") + (config.native_tools ? "enabled" : "disabled"));
+            } else {
+                Serial.println("Usage: set_native_tools <on|off>");
+            }
+        } else if (command == "set_intents") {
+            if (argCount >= 1 && (args[0] == "on" || args[0] == "off")) {
+                config.local_intents = (args[0] == "on");
+                config.save();
+                Serial.println(String("Local intents ") + (config.local_intents ? "enabled" : "disabled"));
+            } else {
+                Serial.println("Usage: set_intents <on|off>");
+            }
+        } else if (command == "intents_reload") {
+            int rules = intents.load();
+            Serial.println("Intents: " + String(rules) + " rules, " + String(intents.stats().hits) + " hits / " +
+                           String(intents.stats().misses) + " misses so far");
+        } else if (command == "set_tls_persist") {
+            if (argCount >= 1 && (args[0] == "on" || args[0] == "off")) {
+                config.tls_session_persist = (args[0] == "on");
+                config.save();
+                Serial.println(String("TLS session persistence ") + (config.tls_session_persist ? "enabled" : "disabled") + ". Restart to apply.");
+            } else {
+                Serial.println("Usage: set_tls_persist <on|off>");
+            }
         } else if (command == "config_show") {
             Serial.println("--- Config ---");
             Serial.print("SSID: "); Serial.println(config.wifi_ssid);
@@ -141,6 +205,129 @@ private:
             Serial.print("Telegram: "); Serial.println(config.telegram_token.substring(0, 5) + "...");
             Serial.print("Gemini Key: "); Serial.println(config.gemini_key.substring(0, 5) + "...");
             Serial.print("Groq Key: "); Serial.println(config.groq_key.substring(0, 5) + "...");
+            Serial.print("Groq URL: "); Serial.println(config.groq_url.length() ? config.groq_url : "default");
+            Serial.print("Gemini URL: "); Serial.println(config.gemini_url.length() ? config.gemini_url : "default");
+            Serial.print("Hedging: "); Serial.println(config.hedge_requests ? "on" : "off");
+            Serial.print("Streaming: "); Serial.println(config.stream_replies ? "on" : "off");
+            Serial.print("Native Tools: "); Serial.println(config.native_tools ? "on" : "off");
+            Serial.print("Local Intents: "); Serial.println(config.local_intents ? "on" : "off");
+            Serial.print("Script Tasks: "); Serial.println("core " + String(config.script_core) + ", priority " + String(config.script_priority));
+            Serial.print("TLS Persist: "); Serial.println(config.tls_session_persist ? "on" : "off");
+            Serial.print("History: "); Serial.println(String(config.history_turns) + " turns, " + String(config.history_budget_groq) + "/" + String(config.history_budget_gemini) + " tokens (groq/gemini)");
+            for (int i = 0; i < ROLE_COUNT; i++) {
+                Serial.printf("Model %s: groq %s (%d), gemini %s (%d)\n", MODEL_ROLE_NAMES[i],
+                              config.groq_models[i].model.c_str(), config.groq_models[i].maxTokens,
+                              config.gemini_models[i].model.c_str(), config.gemini_models[i].maxTokens);
+            }
+        } else if (command == "net_stats") {
+            Serial.println(httpPool.statsJson());
+        } else if (command == "memory_info") {
+            Serial.printf("Memory: %u bytes in RAM, version %u\n", (unsigned)memoryStore.size(), (unsigned)memoryStore.version());
+            Serial.printf("Index: %u entries, %u postings (top %d, %d bytes per prompt)\n",
+                          (unsigned)memoryIndex.entryCount(), (unsigned)memoryIndex.postingCount(),
+                          config.memory_top_k, config.memory_budget);
+        } else if (command == "set_memory_budget") {
+            if (argCount >= 2) {
+                config.memory_top_k = args[0].toInt();
+                config.memory_budget = args[1].toInt();
+                config.save();
+                Serial.println("Memory retrieval: top " + String(config.memory_top_k) + ", " + String(config.memory_budget) + " bytes");
+            } else {
+                Serial.println("Usage: set_memory_budget <top_k> <bytes>");
+            }
+        } else if (command == "set_history_budget") {
+            if (argCount >= 3) {
+                config.history_turns = args[0].toInt();
+                config.history_budget_groq = args[1].toInt();
+                config.history_budget_gemini = args[2].toInt();
+                config.save();
+                Serial.println("History: " + String(config.history_turns) + " turns verbatim, budget groq " +
+                               String(config.history_budget_groq) + " / gemini " + String(config.history_budget_gemini) + " tokens");
+            } else {
+                Serial.println("Usage: set_history_budget <turns> <groq_tokens> <gemini_tokens>");
+            }
+        } else if (command == "set_model") {
+            int role = argCount >= 3 ? ConfigManager::roleFromName(args[1]) : -1;
+            if (role >= 0 && (args[0] == "groq" || args[0] == "gemini")) {
+                ModelChoice& m = args[0] == "groq" ? config.groq_models[role] : config.gemini_models[role];
+                m.model = args[2];
+                if (argCount >= 4 && args[3].toInt() > 0) m.maxTokens = args[3].toInt();
+                config.save();
+                Serial.println(args[0] + " " + args[1] + " turns: " + m.model + ", max " + String(m.maxTokens) + " tokens");
+            } else {
+                Serial.println("Usage: set_model <groq|gemini> <route|summarize|memory> <model> [max_tokens]");
+            }
+        } else if (command == "script_list") {
+            Serial.println("Running: " + scripts.listJson());
+            Serial.println("Saved: " + scriptLibrary.listJson());
+        } else if (command == "script_save") {
+            // The steps must be one argument: no spaces, or quoted with single quotes inside
+            if (argCount >= 2) {
+                DynamicJsonDocument doc(args[1].length() * 2 + 256);
+                if (deserializeJson(doc, args[1]) || !doc.is<JsonArray>()) {
+                    Serial.println("Script must be a JSON array of steps");
+                } else {
+                    Serial.println(scriptLibrary.save(args[0], doc.as<JsonArray>(), argCount >= 3 && args[2] == "autostart"));
+                }
+            } else {
+                Serial.println("Usage: script_save <name> \"[{'cmd':'gpio','pin':2,'state':1}, ...]\" [autostart]");
+            }
+        } else if (command == "script_run") {
+            if (argCount >= 1) {
+                Serial.println(scriptLibrary.run(args[0]));
+            } else {
+                Serial.println("Usage: script_run <name>");
+            }
+        } else if (command == "script_delete") {
+            if (argCount >= 1) {
+                Serial.println(scriptLibrary.remove(args[0]) ? "Deleted" : "No such script");
+            } else {
+                Serial.println("Usage: script_delete <name>");
+            }
+        } else if (command == "script_stop") {
+            if (argCount >= 1) {
+                uint32_t id = args[0] == "all" ? 0 : args[0].toInt();
+                Serial.println("Stopped " + String(scripts.stop(id)) + " script(s)");
+            } else {
+                Serial.println("Usage: script_stop <id|all>");
+            }
+        } else if (command == "set_script_task") {
+            if (argCount >= 2) {
+                config.script_core = args[0].toInt();
+                config.script_priority = args[1].toInt();
+                config.save();
+                scripts.setTaskConfig(config.script_core, config.script_priority);
+                Serial.println("New scripts run on core " + String(config.script_core) + " at priority " + String(config.script_priority));
+            } else {
+                Serial.println("Usage: set_script_task <core 0|1|-1> <priority 1-2>");
+            }
+        } else if (command == "rule_list") {
+            Serial.println(rules.listJson());
+        } else if (command == "rule_add") {
+            // Same object as the rule_add tool, as one argument (single quotes inside)
+            if (argCount >= 1) {
+                DynamicJsonDocument doc(args[0].length() * 2 + 256);
+                if (deserializeJson(doc, args[0]) || !doc.is<JsonObject>()) {
+                    Serial.println("Rule must be a JSON object");
+                } else {
+                    const char* tool = doc["tool"] | "";
+                    if (*tool && !Tools::isRuleAction(tool)) Serial.println(String("Error: Rules cannot call ") + tool);
+                    else Serial.println(rules.add(doc.as<JsonObject>()));
+                }
+            } else {
+                Serial.println("Usage: rule_add \"{'pin':4,'edge':'rising','pull':'up','script':'blink'}\"");
+            }
+        } else if (command == "rule_remove") {
+            if (argCount >= 1) {
+                Serial.println(rules.remove(args[0].toInt()) ? "Removed" : "No such rule");
+            } else {
+                Serial.println("Usage: rule_remove <id>");
+            }
+        } else if (command == "rules_reload") {
+            Serial.println("Rules active: " + String(rules.load()));
+        } else if (command == "memory_reindex") {
+            memoryIndex.rebuild();
+            Serial.println("Memory index rebuilt: " + String(memoryIndex.entryCount()) + " entries");
         } else if (command == "system_info") {
             Serial.println(SystemTools::getSystemInfo());
         } else if (command == "gpio_set") {
@@ -151,6 +338,26 @@ private:
             } else {
                 Serial.println("Usage: gpio_set <pin> <0/1>");
             }
+        } else if (command == "gpio_mask") {
+            if (argCount >= 1) {
+                Serial.println(GpioTools::setMask(parsePins(args[0]), argCount >= 2 ? parsePins(args[1]) : 0));
+            } else {
+                Serial.println("Usage: gpio_mask <high pins, e.g. 4,5> [low pins]");
+            }
+        } else if (command == "pulse_count") {
+            if (argCount >= 1) {
+                Serial.println(PulseTools::measure(args[0].toInt(), argCount >= 2 ? args[1].toInt() : PULSE_GATE_DEFAULT_MS,
+                                                   argCount >= 3 ? args[2].toInt() : 0, argCount >= 4 ? args[3].c_str() : "rising"));
+            } else {
+                Serial.println("Usage: pulse_count <pin> [gate_ms] [filter_ns] [rising|falling|both]");
+            }
+        } else if (command == "adc_sample") {
+            if (argCount >= 1) {
+                Serial.println(AdcSampler::sample(args[0].toInt(), argCount >= 2 ? args[1].toInt() : ADC_SAMPLES_DEFAULT,
+                                                  argCount >= 3 ? args[2].toInt() : ADC_RATE_DEFAULT, argCount >= 4 && args[3] == "fft"));
+            } else {
+                Serial.println("Usage: adc_sample <pin 32-39> [samples] [rate_hz] [fft]");
+            }
         } else if (command == "gpio_get") {
             if (argCount >= 1) {
                 int pin = args[0].toInt();
@@ -161,8 +368,26 @@ private:
         } else if (command == "restart") {
             ESP.restart();
         } else {
-            Serial.println("Unknown command. Available: wifi_set, set_tg_token, set_api_key, config_show, restart, system_info, gpio_set, gpio_get");
+            Serial.println("Unknown command. Available: wifi_set, set_tg_token, set_api_key, set_groq_url, set_gemini_url, set_hedging, provider_stats, set_stream, set_native_tools, set_intents, intents_reload, set_tls_persist, config_show, restart, system_info, net_stats, memory_info, set_memory_budget, set_history_budget, set_model, script_list, script_save, script_run, script_delete, script_stop, set_script_task, rule_list, rule_add, rule_remove, rules_reload, memory_reindex, gpio_set, gpio_mask, gpio_get, pulse_count, adc_sample");
+        }
+    }
+
+    // "4,5,12" -> pin mask; "-" or "" for none
+    static uint64_t parsePins(const String& list) {
+        uint64_t mask = 0;
+        int start = 0;
+        while (start < (int)list.length()) {
+            int comma = list.indexOf(',', start);
+            if (comma < 0) comma = list.length();
+            String item = list.substring(start, comma);
+            item.trim();
+            if (item.length() && item != "-") {
+                int pin = item.toInt();
+                mask |= (pin >= 0 && pin < 63) ? 1ULL << pin : 1ULL << 63;
+            }
+            start = comma + 1;
         }
+        return mask;
     }
 };
 
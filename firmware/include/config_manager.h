@@ -5,6 +5,21 @@
 #include "file_system.h"
 #include "secrets.h" // Fallback defaults
 
+// What an LLM call is for; each kind can use its own model and token cap
+enum ModelRole {
+    ROLE_ROUTE = 0,      // First turn: pick a tool or answer
+    ROLE_SUMMARIZE = 1,  // Follow-up: phrase a tool result
+    ROLE_MEMORY = 2,     // Follow-up after a memory tool
+    ROLE_COUNT = 3
+};
+
+struct ModelChoice {
+    String model;
+    int maxTokens;
+};
+
+static const char* const MODEL_ROLE_NAMES[ROLE_COUNT] = {"route", "summarize", "memory"};
+
 class ConfigManager {
 public:
     String wifi_ssid;
@@ -13,6 +28,32 @@ public:
     String gemini_key;
     String groq_key;
     String ai_provider; // "gemini" or "groq"
+    String groq_url;    // Empty = api.groq.com; http:// stand-ins allowed for testing
+    String gemini_url;  // Empty = Google's models/ base URL; same testing use
+    bool hedge_requests = false; // Also ask the other provider when the primary is slow
+    bool stream_replies = true; // Use SSE streaming completions where supported
+    bool native_tools = true;   // Groq: send a function schema instead of the prompt tool list
+    bool tls_session_persist = true; // Keep TLS session tickets on LittleFS across reboots
+    int memory_top_k = 5;          // Memory entries injected per prompt
+    int memory_budget = 1024;      // Max bytes of memory text per prompt
+    int history_turns = 4;         // Newest turns kept verbatim in the prompt
+    int history_budget_groq = 1500;   // History token budget per provider
+    int history_budget_gemini = 4000;
+    bool local_intents = true;     // Answer rules in /intents.json without calling the LLM
+    int script_core = 1;           // Core script tasks run on (0, 1, or -1 for either)
+    int script_priority = 1;       // FreeRTOS priority of script tasks
+    // Per call kind: a large model routes, small fast ones phrase results
+    ModelChoice groq_models[ROLE_COUNT] = {
+        {"openai/gpt-oss-120b", 1024}, {"llama-3.1-8b-instant", 256}, {"llama-3.1-8b-instant", 512}};
+    ModelChoice gemini_models[ROLE_COUNT] = {
+        {"gemini-2.5-flash", 2048}, {"gemini-2.5-flash-lite", 512}, {"gemini-2.5-flash-lite", 1024}};
+
+    static int roleFromName(const String& name) {
+        for (int i = 0; i < ROLE_COUNT; i++) {
+            if (name == MODEL_ROLE_NAMES[i]) return i;
+        }
+        return -1;
+    }
 
     void begin() {
         // Load from file, fallback to secrets.h
@@ -25,9 +66,11 @@ public:
             groq_key = ""; 
             ai_provider = "groq"; // Default to Groq as requested
             telegram_token = ""; 
+            groq_url = "";
+            gemini_url = "";
             save(); // Save defaults to file
         } else {
-            DynamicJsonDocument doc(1024);
+            DynamicJsonDocument doc(3072);
             deserializeJson(doc, jsonStats);
             wifi_ssid = doc["wifi_ssid"].as<String>();
             wifi_password = doc["wifi_password"].as<String>();
@@ -37,23 +80,74 @@ public:
             if (doc.containsKey("groq_key")) groq_key = doc["groq_key"].as<String>();
             if (doc.containsKey("ai_provider")) ai_provider = doc["ai_provider"].as<String>();
             else ai_provider = "groq"; // Default fallback
+            if (doc.containsKey("groq_url")) groq_url = doc["groq_url"].as<String>();
+            if (doc.containsKey("gemini_url")) gemini_url = doc["gemini_url"].as<String>();
+            if (doc.containsKey("hedge_requests")) hedge_requests = doc["hedge_requests"];
+            if (doc.containsKey("stream_replies")) stream_replies = doc["stream_replies"];
+            if (doc.containsKey("native_tools")) native_tools = doc["native_tools"];
+            if (doc.containsKey("tls_session_persist")) tls_session_persist = doc["tls_session_persist"];
+            if (doc.containsKey("memory_top_k")) memory_top_k = doc["memory_top_k"];
+            if (doc.containsKey("memory_budget")) memory_budget = doc["memory_budget"];
+            if (doc.containsKey("history_turns")) history_turns = doc["history_turns"];
+            if (doc.containsKey("history_budget_groq")) history_budget_groq = doc["history_budget_groq"];
+            if (doc.containsKey("history_budget_gemini")) history_budget_gemini = doc["history_budget_gemini"];
+            if (doc.containsKey("local_intents")) local_intents = doc["local_intents"];
+            if (doc.containsKey("script_core")) script_core = doc["script_core"];
+            if (doc.containsKey("script_priority")) script_priority = doc["script_priority"];
+            loadModels(doc["models"]["groq"], groq_models);
+            loadModels(doc["models"]["gemini"], gemini_models);
         }
     }
 
     void save() {
-        DynamicJsonDocument doc(1024);
+        DynamicJsonDocument doc(3072);
         doc["wifi_ssid"] = wifi_ssid;
         doc["wifi_password"] = wifi_password;
         doc["telegram_token"] = telegram_token;
         doc["gemini_key"] = gemini_key;
         doc["groq_key"] = groq_key;
         doc["ai_provider"] = ai_provider;
+        doc["groq_url"] = groq_url;
+        doc["gemini_url"] = gemini_url;
+        doc["hedge_requests"] = hedge_requests;
+        doc["stream_replies"] = stream_replies;
+        doc["native_tools"] = native_tools;
+        doc["tls_session_persist"] = tls_session_persist;
+        doc["memory_top_k"] = memory_top_k;
+        doc["memory_budget"] = memory_budget;
+        doc["history_turns"] = history_turns;
+        doc["history_budget_groq"] = history_budget_groq;
+        doc["history_budget_gemini"] = history_budget_gemini;
+        doc["local_intents"] = local_intents;
+        doc["script_core"] = script_core;
+        doc["script_priority"] = script_priority;
+        saveModels(doc["models"].createNestedObject("groq"), groq_models);
+        saveModels(doc["models"].createNestedObject("gemini"), gemini_models);
 
         String output;
         serializeJson(doc, output);
         fsManager.writeFile("/config.json", output.c_str());
         Serial.println("Config saved");
     }
+
+private:
+    // Stored as "models": {"groq": {"route": ["model", max_tokens], ...}, ...}
+    static void loadModels(JsonObject src, ModelChoice* models) {
+        for (int i = 0; i < ROLE_COUNT; i++) {
+            JsonArray entry = src[MODEL_ROLE_NAMES[i]];
+            if (entry.size() < 2) continue;
+            models[i].model = entry[0].as<String>();
+            models[i].maxTokens = entry[1];
+        }
+    }
+
+    static void saveModels(JsonObject dst, const ModelChoice* models) {
+        for (int i = 0; i < ROLE_COUNT; i++) {
+            JsonArray entry = dst.createNestedArray(MODEL_ROLE_NAMES[i]);
+            entry.add(models[i].model);
+            entry.add(models[i].maxTokens);
+        }
+    }
 };
 
 extern ConfigManager config;
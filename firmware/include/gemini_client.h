@@ -1,150 +1,168 @@
 #ifndef GEMINI_CLIENT_H
 #define GEMINI_CLIENT_H
 
-#include <WiFiClientSecure.h>
-#include <HTTPClient.h>
 #include "common.h"
+#include "http_pool.h"
+#include "http_stream.h"
+#include "prompt_builder.h"
+#include "prompts.h"
+#include "agent_response.h"
+
+// 1. Tools: the same set as GROQ_BODY_TOOLS, in Gemini's schema dialect
+//    (upper-case types, no integer enums, OBJECTs need properties)
+// 2. User content, whose text is the escaped prompt
+static constexpr char GEMINI_BODY_HEAD[] PROGMEM = R"json("tools":[{"function_declarations":[)json"
+    R"json({"name":"get_system_stats","description":"Heap memory, uptime, CPU frequency and flash size."},)json"
+    R"json({"name":"gpio_control","description":"Set or read one GPIO pin.","parameters":{"type":"OBJECT","properties":{)json"
+        R"json("pin":{"type":"INTEGER"},"mode":{"type":"STRING","enum":["output","input"]},"state":{"type":"INTEGER","description":"Output level 0 or 1; ignored for input"}},"required":["pin","mode"]}},)json"
+    R"json({"name":"gpio_mask","description":"Drive several output pins at the same instant: pins in set go HIGH, pins in clear go LOW.",)json"
+        R"json("parameters":{"type":"OBJECT","properties":{"set":{"type":"ARRAY","items":{"type":"INTEGER"}},"clear":{"type":"ARRAY","items":{"type":"INTEGER"}}}}},)json"
+    R"json({"name":"pulse_count","description":"Count pulses on an input pin in hardware for a gate time; returns count and frequency in Hz (flow meters, encoders, tachometers).",)json"
+        R"json("parameters":{"type":"OBJECT","properties":{"pin":{"type":"INTEGER"},"gate_ms":{"type":"INTEGER","description":"1-10000, default 1000"},"filter_ns":{"type":"INTEGER","description":"Ignore pulses shorter than this, 0-12787"},"edge":{"type":"STRING","enum":["rising","falling","both"]}},"required":["pin"]}},)json"
+    R"json({"name":"adc_sample","description":"Sample an analog input (GPIO 32-39) at a fixed rate and return min/max/mean/RMS in mV, optionally the strongest frequency (vibration, current).",)json"
+        R"json("parameters":{"type":"OBJECT","properties":{"pin":{"type":"INTEGER"},"samples":{"type":"INTEGER","description":"1-16384, default 2048"},"rate_hz":{"type":"INTEGER","description":"1000-100000, default 10000"},"fft":{"type":"BOOLEAN"}},"required":["pin"]}},)json"
+    R"json({"name":"wifi_scan","description":"List the strongest nearby WiFi networks."},)json"
+    R"json({"name":"ble_scan","description":"List nearby Bluetooth LE devices."},)json"
+    R"json({"name":"ble_connect","description":"Connect to a BLE device.","parameters":{"type":"OBJECT","properties":{"address":{"type":"STRING"}},"required":["address"]}},)json"
+    R"json({"name":"ble_disconnect","description":"Disconnect the current BLE device."},)json"
+    R"json({"name":"memory_write","description":"Save a fact to long-term memory.","parameters":{"type":"OBJECT","properties":{"content":{"type":"STRING"}},"required":["content"]}},)json"
+    R"json({"name":"memory_read","description":"Read all of long-term memory."},)json"
+    R"json({"name":"run_script","description":"Run a GPIO script in the background (blinking, patterns). Returns immediately; say the script has started.",)json"
+        R"json("parameters":{"type":"OBJECT","properties":{"script":{"type":"ARRAY","items":{"type":"OBJECT","description":"{cmd:'gpio',pin,state} | {cmd:'gpio_mask',set,clear} | {cmd:'delay',ms} | {cmd:'delay_us',us} | {cmd:'loop',count,steps}","properties":{)json"
+            R"json("cmd":{"type":"STRING","enum":["gpio","gpio_mask","delay","delay_us","loop"]},"pin":{"type":"INTEGER"},"state":{"type":"INTEGER"},)json"
+            R"json("set":{"type":"ARRAY","items":{"type":"INTEGER"}},"clear":{"type":"ARRAY","items":{"type":"INTEGER"}},"ms":{"type":"INTEGER"},"us":{"type":"INTEGER"},"count":{"type":"INTEGER"},)json"
+            R"json("steps":{"type":"ARRAY","items":{"type":"OBJECT","properties":{"cmd":{"type":"STRING"},"pin":{"type":"INTEGER"},"state":{"type":"INTEGER"},"ms":{"type":"INTEGER"},"us":{"type":"INTEGER"}}}}},)json"
+            R"json("required":["cmd"]}}},"required":["script"]}},)json"
+    R"json({"name":"script_save","description":"Save a run_script script under a name so it can be re-run later without regenerating it.",)json"
+        R"json("parameters":{"type":"OBJECT","properties":{"name":{"type":"STRING","description":"Letters, digits, - or _"},"script":{"type":"ARRAY","items":{"type":"OBJECT","description":"As for run_script",)json"
+            R"json("properties":{"cmd":{"type":"STRING"},"pin":{"type":"INTEGER"},"state":{"type":"INTEGER"},"ms":{"type":"INTEGER"},"us":{"type":"INTEGER"},"count":{"type":"INTEGER"}}}},)json"
+            R"json("autostart":{"type":"BOOLEAN","description":"Also run it at every boot"}},"required":["name","script"]}},)json"
+    R"json({"name":"script_run","description":"Run a saved script by name.","parameters":{"type":"OBJECT","properties":{"name":{"type":"STRING"}},"required":["name"]}},)json"
+    R"json({"name":"script_list","description":"List running scripts (ids, pins) and saved script names."},)json"
+    R"json({"name":"script_stop","description":"Stop a running script.","parameters":{"type":"OBJECT","properties":{"id":{"type":"INTEGER","description":"Script id"},"all":{"type":"BOOLEAN","description":"Stop every running script instead"}}}},)json"
+    R"json({"name":"rule_add","description":"React to an input pin on-device: when it changes, run a saved script or a tool. Give script or tool+args.",)json"
+        R"json("parameters":{"type":"OBJECT","properties":{"pin":{"type":"INTEGER"},"edge":{"type":"STRING","enum":["rising","falling","change"]},"debounce_ms":{"type":"INTEGER","description":"Default 50"},)json"
+        R"json("pull":{"type":"STRING","enum":["up","down","none"]},"script":{"type":"STRING","description":"Saved script name"},"tool":{"type":"STRING","description":"gpio_control, gpio_mask, pulse_count, adc_sample, script_run or script_stop"},)json"
+        R"json("args":{"type":"OBJECT","description":"The tool's arguments","properties":{"pin":{"type":"INTEGER"},"mode":{"type":"STRING"},"state":{"type":"INTEGER"},)json"
+            R"json("set":{"type":"ARRAY","items":{"type":"INTEGER"}},"clear":{"type":"ARRAY","items":{"type":"INTEGER"}},"gate_ms":{"type":"INTEGER"},"samples":{"type":"INTEGER"},"rate_hz":{"type":"INTEGER"},"name":{"type":"STRING"},"id":{"type":"INTEGER"}}}},"required":["pin"]}},)json"
+    R"json({"name":"rule_list","description":"List input rules and how often each fired."},)json"
+    R"json({"name":"rule_remove","description":"Delete an input rule.","parameters":{"type":"OBJECT","properties":{"id":{"type":"INTEGER"}},"required":["id"]}})json"
+    R"json(]}],"contents":{"role":"user","parts":[{"text":")json";
+
+static constexpr char GEMINI_BODY_TAIL[] PROGMEM = R"json("}]}})json";
+
+#define GEMINI_API_BASE "https://generativelanguage.googleapis.com/v1beta/models/"
+#define GEMINI_CONFIG_MAX 96   // {"generationConfig":{"maxOutputTokens":N,"thinkingConfig":{"thinkingBudget":0}}},
 
 class GeminiClient {
 public:
-    GeminiClient(const char* apiKey) : _apiKey(apiKey) {}
-
-    String generateContent(String prompt) {
+    // baseUrl (up to and including "models/") may point at a plain http://
+    // stand-in server for local testing
+    GeminiClient(const char* apiKey, const char* baseUrl = nullptr)
+        : _apiKey(apiKey), _base((baseUrl && *baseUrl) ? baseUrl : GEMINI_API_BASE) {}
+
+    // Runs on `model` with at most maxTokens of output.
+    // followUp: the prompt carries a tool result to be summarised
+    AgentResponse generateContent(const PromptBuilder& prompt, const char* model, int maxTokens, bool followUp = false) {
         if (WiFi.status() != WL_CONNECTED) {
-            return "{\"error\": \"WiFi not connected\"}";
+            return AgentResponse::failure("WiFi not connected");
         }
 
-        HTTPClient http;
-        WiFiClientSecure client;
-        client.setInsecure(); // For prototyping; use root CA for production
-
-        String url = "https://generativelanguage.googleapis.com/v1beta/models/gemini-2.5-flash:generateContent?key=" + String(_apiKey);
-
-        if (!http.begin(client, url)) {
-            return "{\"error\": \"Unable to connect\"}";
+        String url = String(_base) + model + ":generateContent?key=" + String(_apiKey);
+
+        // Tool declarations and envelope are pre-serialized in flash; only the
+        // generation config and the escaped prompt from the arena are spliced in.
+        SegmentStream body;
+        // 2.5 Flash models think by default and the thinking counts against
+        // maxOutputTokens, which would leave little or nothing for the reply;
+        // it is turned off there. Older Flash models do not think and reject
+        // thinkingConfig; 2.5 Pro cannot turn it off, so is left as is.
+        char config[GEMINI_CONFIG_MAX];
+        bool noThinking = strncmp(model, "gemini-2.5-flash", 16) == 0;
+        body.add(config, snprintf(config, sizeof(config), "{\"generationConfig\":{\"maxOutputTokens\":%d%s},", maxTokens,
+                                  noThinking ? ",\"thinkingConfig\":{\"thinkingBudget\":0}" : ""));
+        body.add(GEMINI_BODY_HEAD, FLASH_LEN(GEMINI_BODY_HEAD));
+        body.add(prompt.c_str(), prompt.length());
+        addInstructions(body, false, followUp);
+        body.add(GEMINI_BODY_TAIL, FLASH_LEN(GEMINI_BODY_TAIL));
+
+        int httpCode;
+        HTTPClient* http = httpPool.perform(url, [&](HTTPClient& h) {
+            const char* headerKeys[] = {"Transfer-Encoding"};
+            h.collectHeaders(headerKeys, 1);
+            h.addHeader("Content-Type", "application/json");
+            body.rewind();
+            return h.sendRequest("POST", &body, body.size());
+        }, &httpCode);
+        if (!http) {
+            return AgentResponse::failure("Unable to connect");
         }
-
-        http.addHeader("Content-Type", "application/json");
-
-        // Construct JSON payload with Tools
-        DynamicJsonDocument doc(4096);
-        
-        // 1. Define Tools
-        JsonArray toolsArray = doc.createNestedArray("tools");
-        JsonObject funcDeclObj = toolsArray.createNestedObject();
-        JsonArray funcDecls = funcDeclObj.createNestedArray("function_declarations");
-
-        // Tool: get_system_stats
-        JsonObject t1 = funcDecls.createNestedObject();
-        t1["name"] = "get_system_stats";
-        t1["description"] = "Get current system statistics like heap memory, uptime, cpu frequency, and flash size.";
-
-        // Tool: claw_control
-        JsonObject t2 = funcDecls.createNestedObject();
-        t2["name"] = "claw_control";
-        t2["description"] = "Control the claw mechanism.";
-        JsonObject t2Params = t2.createNestedObject("parameters");
-        t2Params["type"] = "OBJECT";
-        JsonObject t2Props = t2Params.createNestedObject("properties");
-        JsonObject t2P1 = t2Props.createNestedObject("action");
-        t2P1["type"] = "STRING";
-        t2P1["description"] = "Action to perform: 'open' or 'close'";
-        JsonArray t2Req = t2Params.createNestedArray("required");
-        t2Req.add("action");
-
-         // Tool: gpio_control
-        JsonObject t3 = funcDecls.createNestedObject();
-        t3["name"] = "gpio_control";
-        t3["description"] = "Control GPIO pins on the ESP32.";
-        JsonObject t3Params = t3.createNestedObject("parameters");
-        t3Params["type"] = "OBJECT";
-        JsonObject t3Props = t3Params.createNestedObject("properties");
-        
-        JsonObject t3P1 = t3Props.createNestedObject("pin");
-        t3P1["type"] = "INTEGER";
-        t3P1["description"] = "GPIO Pin Number";
-        
-        JsonObject t3P2 = t3Props.createNestedObject("mode");
-        t3P2["type"] = "STRING";
-        t3P2["description"] = "Mode: 'output' or 'input'";
-
-        JsonObject t3P3 = t3Props.createNestedObject("state");
-        t3P3["type"] = "INTEGER";
-        t3P3["description"] = "State for output (0/1). Ignored for input.";
-
-        JsonArray t3Req = t3Params.createNestedArray("required");
-        t3Req.add("pin");
-        t3Req.add("mode");
-
-
-        // 2. User Content
-        JsonObject content = doc.createNestedObject("contents");
-        content["role"] = "user";
-        JsonArray parts = content.createNestedArray("parts");
-        JsonObject part = parts.createNestedObject();
-        part["text"] = prompt;
-
-        String payload;
-        serializeJson(doc, payload);
-
-        int httpCode = http.POST(payload);
-        String result = "";
+        AgentResponse result;
 
         if (httpCode == HTTP_CODE_OK) {
-            String response = http.getString();
-            
-            DynamicJsonDocument responseDoc(8192);
-            DeserializationError error = deserializeJson(responseDoc, response);
+            // Parsed straight off the socket; usage metadata, safety ratings
+            // and thought signatures are skipped by the filter
+            HttpBodyStream response(http->getStreamPtr(),
+                                http->header("Transfer-Encoding").equalsIgnoreCase("chunked"),
+                                http->getSize());
+            StaticJsonDocument<128> filter;
+            filter["candidates"][0]["content"]["parts"][0]["text"] = true;
+            filter["candidates"][0]["content"]["parts"][0]["functionCall"] = true;
+
+            DynamicJsonDocument responseDoc(responseDocCapacity(maxTokens));
+            DeserializationError error = deserializeJson(responseDoc, response, DeserializationOption::Filter(filter));
+            response.drain();
+            if (!response.finished()) http->setReuse(false);
 
             if (!error) {
-                // Check if model wants to call a function
-                // Gemini Format: candidates[0].content.parts[0].functionCall
-                JsonObject funcCall = responseDoc["candidates"][0]["content"]["parts"][0]["functionCall"];
-                
-                if (!funcCall.isNull()) {
-                    String funcName = funcCall["name"].as<String>();
-                    JsonObject args = funcCall["args"];
-                    String toolOutput = "";
-
-                    if (funcName == "get_system_stats" || funcName == "claw_control" || funcName == "gpio_control" || funcName == "memory_write" || funcName == "memory_read") {
-                        // Translate Native Tool Call to the JSON format main.cpp expects
-                        // main.cpp expects: {"thought": "...", "tool": "name", "args": {...}, "reply": "..."}
-                        
-                        DynamicJsonDocument jsonDoc(2048);
-                        jsonDoc["thought"] = "Agent invoked native tool: " + funcName;
-                        jsonDoc["tool"] = funcName;
-                        jsonDoc["args"] = args; // Copy args object directly
-                        jsonDoc["reply"] = "Executing " + funcName + "...";
-                        
-                        serializeJson(jsonDoc, result);
-                    } else {
-                        // Unknown tool
-                         result = "{\"thought\": \"Unknown tool called\", \"tool\": \"none\", \"reply\": \"Error: Model tried to call unknown tool " + funcName + "\"}";
-                    }
+                // Check if model wants to call functions
+                // Gemini Format: candidates[0].content.parts[i].functionCall, one part per call
+                JsonArray parts = responseDoc["candidates"][0]["content"]["parts"];
+                bool hasCall = false;
+                for (JsonObject part : parts) {
+                    if (part.containsKey("functionCall")) hasCall = true;
+                }
 
+                if (hasCall) {
+                    // Every call goes to the tool runner, so an unknown name
+                    // comes back as an "Unknown tool" result rather than vanishing
+                    JsonArray calls = result.beginCalls(responseDoc.memoryUsage() + 512);
+                    String names;
+                    for (JsonObject part : parts) {
+                        JsonObject funcCall = part["functionCall"];
+                        if (funcCall.isNull()) continue;
+                        JsonObject entry = calls.createNestedObject();
+                        entry["tool"] = funcCall["name"].as<String>();
+                        entry["args"] = funcCall["args"]; // Copy args object directly
+                        if (names.length()) names += ", ";
+                        names += funcCall["name"].as<String>();
+                    }
+                    result.thought = "Agent invoked native tool: " + names;
+                    result.reply = "Executing " + names + "...";
                 } else {
                     const char* outputText = responseDoc["candidates"][0]["content"]["parts"][0]["text"];
                     if (outputText) {
-                        result = String(outputText);
+                        result.parse(outputText);
                     } else {
-                        result = "{\"error\": \"No text in response\"}";
+                        result = AgentResponse::failure("No text in response");
                     }
                 }
             } else {
-                result = "{\"error\": \"JSON parsing failed\"}";
+                result = AgentResponse::failure(String("JSON parsing failed: ") + error.c_str());
             }
         } else {
              // Debug info
-             String err = http.getString();
-            result = "{\"error\": \"HTTP Error " + String(httpCode) + ": " + err + "\"}";
+             String err = http->getString();
+            result = AgentResponse::failure("HTTP Error " + String(httpCode) + ": " + err);
         }
 
-        http.end();
+        httpPool.release(http);
         return result;
     }
 
 private:
     const char* _apiKey;
+    const char* _base;
 };
 
 #endif
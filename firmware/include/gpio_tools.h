@@ -2,44 +2,132 @@
 #define GPIO_TOOLS_H
 
 #include <Arduino.h>
+#include <ArduinoJson.h>
+#include <soc/gpio_struct.h>
+
+// Safe pins for ESP32 (excluding flash, input-only, etc depends on specific board but this is a general safe list for DevKit V1)
+// 2 (Builtin LED), 4, 5, 12, 13, 14, 15, 16, 17, 18, 19, 21, 22, 23, 25, 26, 27, 32, 33
+// Input only: 34, 35, 36, 39
+// One bit per GPIO number
+#define GPIO_OUTPUT_PIN_MASK 0x30EEFF034ULL
+#define GPIO_INPUT_ONLY_PIN_MASK 0x9C00000000ULL
 
 class GpioTools {
 public:
-    // Safe pins for ESP32 (excluding flash, input-only, etc depends on specific board but this is a general safe list for DevKit V1)
-    // 2 (Builtin LED), 4, 5, 12, 13, 14, 15, 16, 17, 18, 19, 21, 22, 23, 25, 26, 27, 32, 33
-    // Input only: 34, 35, 36, 39
-    
     static bool isValidOutputPin(int pin) {
-        int safe[] = {2, 4, 5, 12, 13, 14, 15, 16, 17, 18, 19, 21, 22, 23, 25, 26, 27, 32, 33};
-        for (int p : safe) {
-            if (p == pin) return true;
-        }
-        return false;
+        return pin >= 0 && pin < 64 && (GPIO_OUTPUT_PIN_MASK & (1ULL << pin));
     }
 
     static bool isValidInputPin(int pin) {
         // Output pins + input only pins
-        if (isValidOutputPin(pin)) return true;
-        int inputs[] = {34, 35, 36, 39};
-        for (int p : inputs) {
-            if (p == pin) return true;
-        }
-        return false;
+        return pin >= 0 && pin < 64 && ((GPIO_OUTPUT_PIN_MASK | GPIO_INPUT_ONLY_PIN_MASK) & (1ULL << pin));
     }
 
     static String setPin(int pin, int value) {
         if (!isValidOutputPin(pin)) return "Error: Invalid Output Pin " + String(pin);
-        pinMode(pin, OUTPUT);
-        digitalWrite(pin, value);
+        configureOutputs(1ULL << pin);
+        writeMask(value ? 1ULL << pin : 0, value ? 0 : 1ULL << pin);
         return "Pin " + String(pin) + " set to " + (value ? "HIGH" : "LOW");
     }
 
     static String getPin(int pin) {
         if (!isValidInputPin(pin)) return "Error: Invalid Input Pin " + String(pin);
-        pinMode(pin, INPUT);
+        configureInput(pin);
         int val = digitalRead(pin);
         return String(val);
     }
+
+    // Drives every pin in `set` high and every pin in `clear` low. Pins are
+    // validated and configured once; the levels then go out as one store to
+    // the GPIO set registers and one to the clear registers.
+    static String setMask(uint64_t set, uint64_t clear) {
+        uint64_t bad = (set | clear) & ~GPIO_OUTPUT_PIN_MASK;
+        if (bad) return "Error: Invalid Output Pin " + String(lowestPin(bad));
+        if (set & clear) return "Error: Pin " + String(lowestPin(set & clear)) + " is both set and cleared";
+        if (!(set | clear)) return "Error: No pins given";
+        configureOutputs(set | clear);
+        writeMask(set, clear);
+        return "Set HIGH: " + pinList(set) + "; LOW: " + pinList(clear);
+    }
+
+    // Puts the pins in `mask` in output mode, calling pinMode() only for pins
+    // not already configured that way
+    static void configureOutputs(uint64_t mask) {
+        uint64_t missing;
+        portENTER_CRITICAL(&modeLock());
+        missing = mask & ~outputModes();
+        outputModes() |= missing;
+        portEXIT_CRITICAL(&modeLock());
+        for (int pin = 0; missing; pin++, missing >>= 1) {
+            if (missing & 1) pinMode(pin, OUTPUT);
+        }
+    }
+
+    // Forgets that pin is an output. Anything that changes a pin's mode
+    // outside configureOutputs (input reads, interrupts, PCNT, ADC) must call
+    // this, or later writes would skip pinMode() and drive nothing.
+    static void invalidatePin(int pin) {
+        if (pin < 0 || pin >= 64) return;
+        portENTER_CRITICAL(&modeLock());
+        outputModes() &= ~(1ULL << pin);
+        portEXIT_CRITICAL(&modeLock());
+    }
+
+    // Register writes for pins already in output mode: GPIO 0-31 and 32-39
+    // sit in separate registers, each written once
+    static inline void writeMask(uint64_t set, uint64_t clear) {
+        if ((uint32_t)set) GPIO.out_w1ts = (uint32_t)set;
+        if (set >> 32) GPIO.out1_w1ts.val = (uint32_t)(set >> 32);
+        if ((uint32_t)clear) GPIO.out_w1tc = (uint32_t)clear;
+        if (clear >> 32) GPIO.out1_w1tc.val = (uint32_t)(clear >> 32);
+    }
+
+    // Bit per pin number in a JSON array of pins; out-of-range numbers set
+    // bit 63, which is never a valid output, so validation rejects them
+    static uint64_t pinMask(JsonVariant pins) {
+        uint64_t mask = 0;
+        for (JsonVariant v : pins.as<JsonArray>()) {
+            int pin = v | -1;
+            mask |= (pin >= 0 && pin < 63) ? 1ULL << pin : 1ULL << 63;
+        }
+        return mask;
+    }
+
+    // "2, 4, 5" for the pins set in mask, "none" if empty
+    static String pinList(uint64_t mask) {
+        if (!mask) return "none";
+        String out;
+        for (int pin = 0; pin < 64; pin++) {
+            if (!(mask & (1ULL << pin))) continue;
+            if (out.length()) out += ", ";
+            out += pin;
+        }
+        return out;
+    }
+
+private:
+    // Pins this firmware has put in output mode
+    static uint64_t& outputModes() {
+        static uint64_t modes = 0;
+        return modes;
+    }
+
+    static portMUX_TYPE& modeLock() {
+        static portMUX_TYPE lock = portMUX_INITIALIZER_UNLOCKED;
+        return lock;
+    }
+
+    static void configureInput(int pin) {
+        invalidatePin(pin);
+        pinMode(pin, INPUT);
+    }
+
+    static int lowestPin(uint64_t mask) {
+        for (int pin = 0; pin < 64; pin++) {
+            if (mask & (1ULL << pin)) return pin;
+        }
+        return -1;
+    }
 };
 
 #endif
@@ -1,110 +1,324 @@
 #ifndef GROQ_CLIENT_H
 #define GROQ_CLIENT_H
 
-#include <WiFiClientSecure.h>
-#include <HTTPClient.h>
 #include "common.h"
+#include "http_pool.h"
+#include "http_stream.h"
+#include "sse_parser.h"
+#include "prompt_builder.h"
+#include "prompts.h"
+#include "agent_response.h"
+
+#define GROQ_API_URL "https://api.groq.com/openai/v1/chat/completions"
+#define GROQ_SSE_LINE_MAX 1024           // On the stack; covers every text delta
+#define GROQ_SSE_LINE_LIMIT 16384        // Heap growth cap for one-chunk tool calls
+#define GROQ_PARAMS_MAX 32               // "<max tokens>,\"stream\":false"
+#define GROQ_MAX_TOOL_CALLS 4            // Streamed tool calls tracked per response
+
+// Request envelope around the escaped prompt, assembled at compile time:
+// head, model, params, token cap + stream flag, tool_choice, tools + messages
+// prefix, prompt, tail
+static constexpr char GROQ_BODY_HEAD[] PROGMEM = "{\"model\":\"";
+static constexpr char GROQ_BODY_PARAMS[] PROGMEM = "\",\"temperature\":1,\"top_p\":1,\"max_completion_tokens\":";
+static constexpr char GROQ_TOOL_CHOICE_AUTO[] PROGMEM = ",\"tool_choice\":\"auto\"";
+static constexpr char GROQ_TOOL_CHOICE_NONE[] PROGMEM = ",\"tool_choice\":\"none\"";
+
+// OpenAI-style function schema for every tool Tools::execute() handles
+static constexpr char GROQ_BODY_TOOLS[] PROGMEM = R"json(,"tools":[)json"
+    R"json({"type":"function","function":{"name":"get_system_stats","description":"Heap memory, uptime, CPU frequency and flash size.","parameters":{"type":"object","properties":{}}}},)json"
+    R"json({"type":"function","function":{"name":"gpio_control","description":"Set or read one GPIO pin.","parameters":{"type":"object","properties":{)json"
+        R"json("pin":{"type":"integer"},"mode":{"type":"string","enum":["output","input"]},"state":{"type":"integer","enum":[0,1],"description":"Output level; ignored for input"}},"required":["pin","mode"]}}},)json"
+    R"json({"type":"function","function":{"name":"gpio_mask","description":"Drive several output pins at the same instant: pins in set go HIGH, pins in clear go LOW.",)json"
+        R"json("parameters":{"type":"object","properties":{"set":{"type":"array","items":{"type":"integer"}},"clear":{"type":"array","items":{"type":"integer"}}}}}},)json"
+    R"json({"type":"function","function":{"name":"pulse_count","description":"Count pulses on an input pin in hardware for a gate time; returns count and frequency in Hz (flow meters, encoders, tachometers).",)json"
+        R"json("parameters":{"type":"object","properties":{"pin":{"type":"integer"},"gate_ms":{"type":"integer","description":"1-10000, default 1000"},"filter_ns":{"type":"integer","description":"Ignore pulses shorter than this, 0-12787"},"edge":{"type":"string","enum":["rising","falling","both"]}},"required":["pin"]}}},)json"
+    R"json({"type":"function","function":{"name":"adc_sample","description":"Sample an analog input (GPIO 32-39) at a fixed rate and return min/max/mean/RMS in mV, optionally the strongest frequency (vibration, current).",)json"
+        R"json("parameters":{"type":"object","properties":{"pin":{"type":"integer"},"samples":{"type":"integer","description":"1-16384, default 2048"},"rate_hz":{"type":"integer","description":"1000-100000, default 10000"},"fft":{"type":"boolean"}},"required":["pin"]}}},)json"
+    R"json({"type":"function","function":{"name":"wifi_scan","description":"List the strongest nearby WiFi networks.","parameters":{"type":"object","properties":{}}}},)json"
+    R"json({"type":"function","function":{"name":"ble_scan","description":"List nearby Bluetooth LE devices.","parameters":{"type":"object","properties":{}}}},)json"
+    R"json({"type":"function","function":{"name":"ble_connect","description":"Connect to a BLE device.","parameters":{"type":"object","properties":{"address":{"type":"string"}},"required":["address"]}}},)json"
+    R"json({"type":"function","function":{"name":"ble_disconnect","description":"Disconnect the current BLE device.","parameters":{"type":"object","properties":{}}}},)json"
+    R"json({"type":"function","function":{"name":"memory_write","description":"Save a fact to long-term memory.","parameters":{"type":"object","properties":{"content":{"type":"string"}},"required":["content"]}}},)json"
+    R"json({"type":"function","function":{"name":"memory_read","description":"Read all of long-term memory.","parameters":{"type":"object","properties":{}}}},)json"
+    R"json({"type":"function","function":{"name":"run_script","description":"Run a GPIO script in the background (blinking, patterns). Returns immediately; say the script has started.",)json"
+        R"json("parameters":{"type":"object","properties":{"script":{"type":"array","items":{"type":"object","description":"{cmd:'gpio',pin,state} | {cmd:'gpio_mask',set:[pins],clear:[pins]} | {cmd:'delay',ms} | {cmd:'delay_us',us} | {cmd:'loop',count,steps:[...]}"}}},"required":["script"]}}},)json"
+    R"json({"type":"function","function":{"name":"script_save","description":"Save a run_script script under a name so it can be re-run later without regenerating it.",)json"
+        R"json("parameters":{"type":"object","properties":{"name":{"type":"string","description":"Letters, digits, - or _"},"script":{"type":"array","items":{"type":"object"}},"autostart":{"type":"boolean","description":"Also run it at every boot"}},"required":["name","script"]}}},)json"
+    R"json({"type":"function","function":{"name":"script_run","description":"Run a saved script by name.","parameters":{"type":"object","properties":{"name":{"type":"string"}},"required":["name"]}}},)json"
+    R"json({"type":"function","function":{"name":"script_list","description":"List running scripts (ids, pins) and saved script names.","parameters":{"type":"object","properties":{}}}},)json"
+    R"json({"type":"function","function":{"name":"script_stop","description":"Stop a running script.","parameters":{"type":"object","properties":{"id":{"type":"integer","description":"Script id"},"all":{"type":"boolean","description":"Stop every running script instead"}}}}},)json"
+    R"json({"type":"function","function":{"name":"rule_add","description":"React to an input pin on-device: when it changes, run a saved script or a tool. Give script or tool+args.",)json"
+        R"json("parameters":{"type":"object","properties":{"pin":{"type":"integer"},"edge":{"type":"string","enum":["rising","falling","change"]},"debounce_ms":{"type":"integer","description":"Default 50"},)json"
+        R"json("pull":{"type":"string","enum":["up","down","none"]},"script":{"type":"string","description":"Saved script name"},"tool":{"type":"string","description":"gpio_control, gpio_mask, pulse_count, adc_sample, script_run or script_stop"},"args":{"type":"object"}},"required":["pin"]}}},)json"
+    R"json({"type":"function","function":{"name":"rule_list","description":"List input rules and how often each fired.","parameters":{"type":"object","properties":{}}}},)json"
+    R"json({"type":"function","function":{"name":"rule_remove","description":"Delete an input rule.","parameters":{"type":"object","properties":{"id":{"type":"integer"}},"required":["id"]}}})json"
+    R"json(],"messages":[{"role":"user","content":")json";
+static constexpr char GROQ_BODY_MESSAGES[] PROGMEM = ",\"messages\":[{\"role\":\"user\",\"content\":\"";
+static constexpr char GROQ_BODY_TAIL[] PROGMEM = "\"}]}";
 
 class GroqClient {
 public:
-    GroqClient(const char* apiKey) : _apiKey(apiKey) {}
+    // baseUrl may point at a plain http:// stand-in server for local testing
+    GroqClient(const char* apiKey, const char* baseUrl = nullptr)
+        : _apiKey(apiKey), _url((baseUrl && *baseUrl) ? baseUrl : GROQ_API_URL) {}
 
-    String generateContent(String prompt) {
+    // Runs on `model` with at most maxTokens of output. Sends the tools schema
+    // when nativeTools is set; on a followUp turn (the tool result is being
+    // summarised) tool_choice is "none". Native tool calls and plain-text
+    // replies both come back as an AgentResponse.
+    AgentResponse generateContent(const PromptBuilder& prompt, const char* model, int maxTokens,
+                           bool nativeTools = false, bool followUp = false) {
         if (WiFi.status() != WL_CONNECTED) {
-            return "{\"error\": \"WiFi not connected\"}";
+            return AgentResponse::failure("WiFi not connected");
         }
 
-        HTTPClient http;
-        WiFiClientSecure client;
-        client.setInsecure(); // For prototyping
+        SegmentStream body;
+        char params[GROQ_PARAMS_MAX];
+        buildBody(body, params, prompt, model, maxTokens, false, nativeTools, followUp);
 
-        String url = "https://api.groq.com/openai/v1/chat/completions";
-
-        if (!http.begin(client, url)) {
-            return "{\"error\": \"Unable to connect to Groq\"}";
+        int httpCode;
+        HTTPClient* http = httpPool.perform(_url, [&](HTTPClient& h) {
+            const char* headerKeys[] = {"Transfer-Encoding"};
+            h.collectHeaders(headerKeys, 1);
+            addHeaders(h);
+            body.rewind();
+            return h.sendRequest("POST", &body, body.size());
+        }, &httpCode);
+        if (!http) {
+            return AgentResponse::failure("Unable to connect to Groq");
         }
-
-        http.addHeader("Content-Type", "application/json");
-        http.addHeader("Authorization", "Bearer " + String(_apiKey));
-
-        // Construct JSON payload using ArduinoJson
-        DynamicJsonDocument doc(4096);
-        doc["model"] = "openai/gpt-oss-120b"; // Default model as requested, or can make configurable
-        doc["temperature"] = 1;
-        doc["max_completion_tokens"] = 1024; // Adjusted for ESP32 memory constraints vs 8192
-        doc["top_p"] = 1;
-        doc["stream"] = false; // We use non-streaming for simplicity in this firmware version
-
-        JsonArray messages = doc.createNestedArray("messages");
-        JsonObject userMsg = messages.createNestedObject();
-        userMsg["role"] = "user";
-        userMsg["content"] = prompt;
-
-        String payload;
-        serializeJson(doc, payload);
-
-        int httpCode = http.POST(payload);
-        String result = "";
+        AgentResponse result;
 
         if (httpCode == HTTP_CODE_OK) {
-            String response = http.getString();
-            
-            // Parse response
-            DynamicJsonDocument responseDoc(8192);
-            DeserializationError error = deserializeJson(responseDoc, response);
+            // Parsed straight off the socket; ids, usage and reasoning are
+            // skipped by the filter, so the document only holds the message
+            HttpBodyStream response(http->getStreamPtr(),
+                                http->header("Transfer-Encoding").equalsIgnoreCase("chunked"),
+                                http->getSize());
+            StaticJsonDocument<128> filter;
+            filter["choices"][0]["message"]["content"] = true;
+            filter["choices"][0]["message"]["tool_calls"] = true;
 
-            if (!error) {
-                // Check for tool calls first
-                JsonArray toolCalls = responseDoc["choices"][0]["message"]["tool_calls"];
-                if (toolCalls.size() > 0) {
-                    // Assuming only one tool call for simplicity in this example
-                    JsonObject toolCall = toolCalls[0];
-                    String functionName = toolCall["function"]["name"];
-                    JsonObject funcArgs = toolCall["function"]["arguments"];
-                    String toolOutput = "";
-
-                    // Placeholder for actual tool execution.
-                    // You would need to define 'claw' and 'SystemTools' objects/functions
-                    // in your main sketch or pass them to GroqClient.
-                    // For this example, we'll assume they are accessible.
-                    // Example: extern Claw claw; extern SystemTools systemTools;
-
-                    if (functionName == "get_system_stats" || functionName == "claw_control" || functionName == "gpio_control") {
-                         // Translate Native Tool Call to the JSON format main.cpp expects
-                        DynamicJsonDocument jsonDoc(2048);
-                        jsonDoc["thought"] = "Agent invoked native tool: " + functionName;
-                        jsonDoc["tool"] = functionName;
-                        jsonDoc["args"] = funcArgs; 
-                        jsonDoc["reply"] = "Executing " + functionName + "...";
-                        
-                        serializeJson(jsonDoc, result);
-                    } else {
-                         result = "{\"thought\": \"Unknown tool called\", \"tool\": \"none\", \"reply\": \"Error: Model tried to call unknown tool " + functionName + "\"}";
-                    }
+            DynamicJsonDocument responseDoc(responseDocCapacity(maxTokens));
+            DeserializationError error = deserializeJson(responseDoc, response, DeserializationOption::Filter(filter));
+            response.drain();
+            if (!response.finished()) http->setReuse(false);
 
+            if (!error) {
+                // Groq/OpenAI format: choices[0].message.{content, tool_calls}
+                JsonObject message = responseDoc["choices"][0]["message"];
+                const char* outputText = message["content"];
+                JsonArray toolCalls = message["tool_calls"];
+                if (toolCalls.size() > 0 || outputText) {
+                    result = toResponse(outputText, toolCalls);
                 } else {
-                    // Groq/OpenAI format: choices[0].message.content
-                    const char* outputText = responseDoc["choices"][0]["message"]["content"];
-                    if (outputText) {
-                        result = String(outputText);
-                    } else {
-                        result = "{\"error\": \"No text in Groq response\"}";
-                    }
+                    result = AgentResponse::failure("No text in Groq response");
                 }
             } else {
-                result = "{\"error\": \"JSON parsing failed\"}";
+                result = AgentResponse::failure(String("JSON parsing failed: ") + error.c_str());
             }
         } else {
-            String errorPayload = http.getString();
-            result = "{\"error\": \"HTTP Error " + String(httpCode) + ": " + errorPayload + "\"}";
+            String errorPayload = http->getString();
+            result = AgentResponse::failure("HTTP Error " + String(httpCode) + ": " + errorPayload);
         }
 
-        http.end();
+        httpPool.release(http);
         return result;
     }
 
+    // Streaming variant: requests an SSE completion and consumes the chunks as
+    // they arrive instead of buffering the whole body. Reply text is forwarded
+    // to onToken; the full message is returned like generateContent().
+    AgentResponse generateContentStream(const PromptBuilder& prompt, const char* model, int maxTokens,
+                                 TokenCallback onToken, bool nativeTools = false, bool followUp = false) {
+        if (WiFi.status() != WL_CONNECTED) {
+            return AgentResponse::failure("WiFi not connected");
+        }
+
+        SegmentStream body;
+        char params[GROQ_PARAMS_MAX];
+        buildBody(body, params, prompt, model, maxTokens, true, nativeTools, followUp);
+
+        int httpCode;
+        HTTPClient* http = httpPool.perform(_url, [&](HTTPClient& h) {
+            const char* headerKeys[] = {"Transfer-Encoding"};
+            h.collectHeaders(headerKeys, 1);
+            addHeaders(h);
+            body.rewind();
+            return h.sendRequest("POST", &body, body.size());
+        }, &httpCode);
+
+        if (!http) {
+            return AgentResponse::failure("Unable to connect to Groq");
+        }
+        if (httpCode != HTTP_CODE_OK) {
+            String errorPayload = http->getString();
+            httpPool.release(http);
+            return AgentResponse::failure("HTTP Error " + String(httpCode) + ": " + errorPayload);
+        }
+
+        HttpBodyStream response(http->getStreamPtr(),
+                            http->header("Transfer-Encoding").equalsIgnoreCase("chunked"),
+                            http->getSize());
+        char line[GROQ_SSE_LINE_MAX];
+        SseReader sse(response, line, sizeof(line), GROQ_SSE_LINE_LIMIT);
+        JsonFieldExtractor extractor(onToken);
+
+        // Each chunk carries ids, model, usage etc.; keep only the deltas
+        StaticJsonDocument<128> filter;
+        filter["choices"][0]["delta"]["content"] = true;
+        filter["choices"][0]["delta"]["tool_calls"] = true;
+
+        // Tool calls arrive as fragments keyed by index; arguments are a JSON
+        // string split across chunks
+        String callName[GROQ_MAX_TOOL_CALLS];
+        String callArgs[GROQ_MAX_TOOL_CALLS];
+        int callCount = 0;
+
+        String content;
+        int jsonReply = -1; // Unknown until the first visible character: 1 = legacy JSON reply
+        size_t len;
+        char* data;
+        while ((data = sse.next(&len)) != nullptr) {
+            StaticJsonDocument<512> chunk;
+            if (deserializeJson(chunk, data, len, DeserializationOption::Filter(filter))) continue;
+
+            JsonObject delta = chunk["choices"][0]["delta"];
+            for (JsonObject call : delta["tool_calls"].as<JsonArray>()) {
+                int index = call["index"] | 0;
+                if (index < 0 || index >= GROQ_MAX_TOOL_CALLS) continue;
+                if (index >= callCount) callCount = index + 1;
+                const char* name = call["function"]["name"];
+                const char* args = call["function"]["arguments"];
+                if (name) callName[index] += name;
+                if (args) callArgs[index] += args;
+            }
+
+            const char* text = delta["content"];
+            if (!text || !*text) continue;
+
+            content += text;
+            if (jsonReply < 0) {
+                const char* p = content.c_str();
+                while (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t') p++;
+                if (*p) jsonReply = (*p == '{') ? 1 : 0;
+            }
+            if (jsonReply == 1) {
+                extractor.feed(text, strlen(text));
+            } else if (onToken) {
+                onToken(text);
+            }
+        }
+
+        // A half-read body would poison the pooled socket for the next request
+        if (!response.finished()) http->setReuse(false);
+        httpPool.release(http);
+
+        // Cut off before [DONE]: the text and tool arguments may be partial,
+        // so fail and let the router try the other provider
+        if (!sse.complete()) {
+            return AgentResponse::failure("Groq stream cut off");
+        }
+        if (content.length() == 0 && callCount == 0) {
+            return AgentResponse::failure("No text in Groq stream");
+        }
+
+        DynamicJsonDocument calls(512);
+        JsonArray toolCalls = calls.to<JsonArray>();
+        for (int i = 0; i < callCount; i++) {
+            if (callName[i].length() == 0) continue;
+            JsonObject fn = toolCalls.createNestedObject().createNestedObject("function");
+            fn["name"] = callName[i].c_str();
+            fn["arguments"] = callArgs[i].c_str();
+        }
+        return toResponse(content.length() ? content.c_str() : nullptr, toolCalls);
+    }
+
 private:
     const char* _apiKey;
+    const char* _url;
+
+    void addHeaders(HTTPClient& http) {
+        http.addHeader("Content-Type", "application/json");
+        http.addHeader("Authorization", "Bearer " + String(_apiKey));
+    }
+
+    // Request JSON is written as segments: envelope pieces and instructions
+    // from flash, and the prompt (escaped in place by PromptBuilder) in between.
+    // params holds the per-request token cap and stream flag; it must outlive
+    // the request.
+    void buildBody(SegmentStream& body, char* params, const PromptBuilder& prompt, const char* model,
+                   int maxTokens, bool stream, bool nativeTools, bool followUp) {
+        body.add(GROQ_BODY_HEAD, FLASH_LEN(GROQ_BODY_HEAD));
+        body.add(model);
+        body.add(GROQ_BODY_PARAMS, FLASH_LEN(GROQ_BODY_PARAMS));
+        body.add(params, snprintf(params, GROQ_PARAMS_MAX, "%d,\"stream\":%s", maxTokens, stream ? "true" : "false"));
+        if (nativeTools) {
+            if (followUp) body.add(GROQ_TOOL_CHOICE_NONE, FLASH_LEN(GROQ_TOOL_CHOICE_NONE));
+            else body.add(GROQ_TOOL_CHOICE_AUTO, FLASH_LEN(GROQ_TOOL_CHOICE_AUTO));
+            body.add(GROQ_BODY_TOOLS, FLASH_LEN(GROQ_BODY_TOOLS));
+        } else {
+            body.add(GROQ_BODY_MESSAGES, FLASH_LEN(GROQ_BODY_MESSAGES));
+        }
+        body.add(prompt.c_str(), prompt.length());
+        addInstructions(body, nativeTools, followUp);
+        body.add(GROQ_BODY_TAIL, FLASH_LEN(GROQ_BODY_TAIL));
+    }
+
+    // Maps a native response onto an AgentResponse. Every tool call goes into
+    // its call list ({tool, args}, or {tool, error} if the arguments do not
+    // parse). Otherwise the text is the reply; text that is a JSON reply
+    // (prompt-encoded tool mode) is parsed as such.
+    static AgentResponse toResponse(const char* content, JsonArray toolCalls) {
+        AgentResponse response;
+        if (toolCalls.size() > 0) {
+            size_t argsLen = 0;
+            for (JsonObject call : toolCalls) {
+                const char* rawArgs = call["function"]["arguments"];
+                if (rawArgs) argsLen += strlen(rawArgs);
+            }
+
+            JsonArray calls = response.beginCalls(argsLen * 3 + 512);
+            String names;
+            for (JsonObject call : toolCalls) {
+                JsonObject fn = call["function"];
+                const char* name = fn["name"];
+                if (!name) continue;
+
+                JsonObject entry = calls.createNestedObject();
+                entry["tool"] = String(name);
+                // OpenAI sends arguments as a JSON-encoded string
+                JsonVariant rawArgs = fn["arguments"];
+                if (rawArgs.is<const char*>()) {
+                    DynamicJsonDocument argsDoc(strlen(rawArgs.as<const char*>()) * 2 + 256);
+                    if (deserializeJson(argsDoc, rawArgs.as<const char*>()) || !argsDoc.is<JsonObject>()) {
+                        // Never run it on default arguments (script_stop id 0, pin 0)
+                        entry["error"] = "Error: Malformed arguments";
+                    } else {
+                        entry["args"] = argsDoc.as<JsonObject>();
+                    }
+                } else {
+                    entry["args"] = rawArgs;
+                }
+                if (names.length()) names += ", ";
+                names += name;
+            }
+            if (calls.size() == 0) return AgentResponse::failure("Malformed tool call from Groq");
+
+            response.thought = "Agent invoked native tool: " + names;
+            response.reply = (content && *content) ? String(content) : String("Executing " + names + "...");
+            return response;
+        }
+
+        const char* p = content ? content : "";
+        while (*p == ' ' || *p == '\n' || *p == '\r' || *p == '\t') p++;
+        if (*p == '{') {
+            response.parse(p);
+        } else {
+            response.reply = p;
+        }
+        return response;
+    }
 };
 
 #endif
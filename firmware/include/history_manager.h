@@ -0,0 +1,101 @@
+#ifndef HISTORY_MANAGER_H
+#define HISTORY_MANAGER_H
+
+#include <ArduinoJson.h>
+#include "prompt_builder.h"
+
+#define HISTORY_MAX_ENTRIES 32
+#define HISTORY_SUMMARY_SNIPPET 96    // Bytes kept per folded turn
+#define HISTORY_TOOL_RESULT_MAX 320   // Bytes of a tool result kept in a verbatim turn
+
+// Fits the conversation history posted by a frontend into a token budget.
+// The newest turns are kept verbatim; older turns are folded into a short
+// summary (one clipped line per turn, tool output dropped). If even the
+// verbatim window is over budget it shrinks, oldest turn first.
+class HistoryManager {
+public:
+    // Rough token estimate for English/JSON text (~4 bytes per token)
+    static size_t estimateTokens(size_t bytes) { return (bytes + 3) / 4; }
+
+    static size_t entryTokens(JsonVariant m) {
+        const char* text = m["text"];
+        const char* toolRes = m["tool_result"];
+        size_t bytes = 8 + (text ? strlen(text) : 0);
+        if (hasToolResult(toolRes)) {
+            size_t n = strlen(toolRes);
+            bytes += 18 + (n < HISTORY_TOOL_RESULT_MAX ? n : HISTORY_TOOL_RESULT_MAX);
+        }
+        return estimateTokens(bytes);
+    }
+
+    // Writes the summary and verbatim window into the prompt. keepTurns is
+    // the verbatim window size, budgetTokens the cap for all history text.
+    static void append(PromptBuilder& prompt, JsonArray history, int keepTurns, size_t budgetTokens) {
+        if (history.isNull() || history.size() == 0) return;
+
+        JsonVariant entries[HISTORY_MAX_ENTRIES];
+        size_t count = 0;
+        size_t skip = history.size() > HISTORY_MAX_ENTRIES ? history.size() - HISTORY_MAX_ENTRIES : 0;
+        for (JsonVariant m : history) {
+            if (skip > 0) { skip--; continue; }
+            entries[count++] = m;
+        }
+
+        // Verbatim window: newest turns, at most 3/4 of the budget
+        size_t verbatimBudget = budgetTokens * 3 / 4;
+        size_t used = 0;
+        size_t split = count;
+        while (split > 0 && (int)(count - split) < keepTurns) {
+            size_t t = entryTokens(entries[split - 1]);
+            if (used + t > verbatimBudget && split < count) break;
+            used += t;
+            split--;
+        }
+
+        // Summary: newest folded turns that fit in what is left
+        size_t summaryBudget = budgetTokens > used ? budgetTokens - used : 0;
+        size_t first = split;
+        size_t summaryUsed = 0;
+        while (first > 0) {
+            const char* text = entries[first - 1]["text"];
+            size_t n = text ? strlen(text) : 0;
+            size_t t = estimateTokens(8 + (n < HISTORY_SUMMARY_SNIPPET ? n : HISTORY_SUMMARY_SNIPPET));
+            if (summaryUsed + t > summaryBudget) break;
+            summaryUsed += t;
+            first--;
+        }
+
+        if (first < split) {
+            prompt.text("Earlier conversation (summary): ");
+            for (size_t i = first; i < split; i++) {
+                prompt.text(isUser(entries[i]) ? "User: " : "AI: ");
+                prompt.text(entries[i]["text"].as<const char*>(), HISTORY_SUMMARY_SNIPPET);
+                prompt.text("; ");
+            }
+        }
+
+        if (split < count) {
+            prompt.text("Recent conversation history (short-term): ");
+            for (size_t i = split; i < count; i++) {
+                const char* toolRes = entries[i]["tool_result"];
+                prompt.text(isUser(entries[i]) ? "User: " : "AI: ").text(entries[i]["text"].as<const char*>());
+                if (hasToolResult(toolRes)) {
+                    prompt.text(" [Tool Result: ").text(toolRes, HISTORY_TOOL_RESULT_MAX).text("]");
+                }
+                prompt.text(" | ");
+            }
+        }
+    }
+
+private:
+    static bool isUser(JsonVariant m) {
+        const char* s = m["sender"];
+        return s && strcmp(s, "user") == 0;
+    }
+
+    static bool hasToolResult(const char* toolRes) {
+        return toolRes && *toolRes && strcmp(toolRes, "null") != 0;
+    }
+};
+
+#endif
@@ -0,0 +1,231 @@
+#ifndef HTTP_POOL_H
+#define HTTP_POOL_H
+
+#include <WiFiClient.h>
+#include <HTTPClient.h>
+#include <ArduinoJson.h>
+#include <functional>
+#include "tls_session.h"
+
+#define HTTP_POOL_SLOTS 3
+#define HTTP_POOL_IDLE_MS 30000     // Proactively drop sockets the server has likely timed out
+#define HTTP_POOL_MIN_HEAP 45000    // Largest free block needed before opening another TLS session
+
+// Keeps one HTTP/1.1 keep-alive connection per host open across requests so
+// repeated LLM / Telegram calls skip the TCP + TLS handshake. Safe to use from
+// several tasks: a slot handed out by perform() belongs to the caller until
+// release(), and is never reused or evicted meanwhile.
+class HttpPool {
+public:
+    HttpPool() { _lock = xSemaphoreCreateMutex(); }
+
+    struct Stats {
+        uint32_t hits = 0;        // Request went out on an already-open socket
+        uint32_t misses = 0;      // Request needed a new connection
+        uint32_t handshakes = 0;  // TLS handshakes started (misses on https hosts); see tlsSessions for full vs resumed
+        uint32_t reconnects = 0;  // Stale reused sockets that had to be reopened
+        uint32_t evictions = 0;   // Idle sockets closed for age or heap pressure
+    };
+
+    // Opens url on a pooled connection and runs send(http), which must add any
+    // headers and issue the request. If a reused socket turns out to be dead,
+    // it is reopened and send() retried once. Returns the slot's HTTPClient
+    // (nullptr for an unusable URL) with the status in *code; the caller reads
+    // the response and then calls release(), which keeps the socket open.
+    // The HTTPClient is owned by the pool: destroying it would close the socket.
+    HTTPClient* perform(const String& url, std::function<int(HTTPClient&)> send, int* code) {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        Slot* slot = acquire(url);
+        if (slot) slot->busy = true;
+        xSemaphoreGive(_lock);
+        if (!slot) {
+            *code = HTTPC_ERROR_CONNECTION_REFUSED;
+            return nullptr;
+        }
+
+        HTTPClient& http = *slot->http;
+        bool reused = slot->client->connected();
+        countConnect(slot, reused);
+
+        http.setReuse(true);
+        if (!http.begin(*slot->client, url)) {
+            *code = HTTPC_ERROR_CONNECTION_REFUSED;
+            return &http;
+        }
+        *code = send(http);
+
+        if (*code < 0 && reused) {
+            // Server closed the idle socket under us; retry on a fresh connection
+            http.end();
+            slot->client->stop();
+            countConnect(slot, false, true);
+            if (!http.begin(*slot->client, url)) {
+                *code = HTTPC_ERROR_CONNECTION_REFUSED;
+                return &http;
+            }
+            *code = send(http);
+        }
+
+        slot->lastUsed = millis();
+        return &http;
+    }
+
+    // Ends the response (the socket stays open) and returns the slot to the pool
+    void release(HTTPClient* http) {
+        if (!http) return;
+        http->end();
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        for (Slot& s : _slots) {
+            if (s.http == http) {
+                s.busy = false;
+                s.lastUsed = millis();
+            }
+        }
+        xSemaphoreGive(_lock);
+    }
+
+    // A consistent copy: perform() runs on the agent, hedge and loop tasks
+    Stats stats() const {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        Stats copy = _stats;
+        xSemaphoreGive(_lock);
+        return copy;
+    }
+
+    String statsJson() const {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        Stats st = _stats;
+        int open = 0;
+        for (const Slot& s : _slots) {
+            if (s.client && s.client->connected()) open++;
+        }
+        xSemaphoreGive(_lock);
+
+        StaticJsonDocument<256> doc;
+        doc["hits"] = st.hits;
+        doc["misses"] = st.misses;
+        doc["handshakes"] = st.handshakes;
+        doc["reconnects"] = st.reconnects;
+        doc["evictions"] = st.evictions;
+        doc["open"] = open;
+        tlsSessions.addStats(doc.as<JsonObject>());
+
+        String output;
+        serializeJson(doc, output);
+        return output;
+    }
+
+private:
+    struct Slot {
+        String host;
+        uint16_t port = 0;
+        bool secure = false;
+        WiFiClient* client = nullptr;
+        HTTPClient* http = nullptr;
+        unsigned long lastUsed = 0;
+        bool busy = false;          // Handed out by perform(), not yet released
+    };
+
+    Slot _slots[HTTP_POOL_SLOTS];
+    Stats _stats;               // Guarded by _lock
+    SemaphoreHandle_t _lock;
+
+    Slot* acquire(const String& url) {
+        bool secure;
+        String host;
+        uint16_t port;
+        if (!parseUrl(url, secure, host, port)) return nullptr;
+
+        Slot* match = nullptr;
+        Slot* victim = nullptr;
+        for (Slot& s : _slots) {
+            if (s.busy) continue;
+            if (s.client && s.secure == secure && s.port == port && s.host == host) {
+                match = &s;
+                break;
+            }
+            if (!victim || !s.client || (victim->client && s.lastUsed < victim->lastUsed)) {
+                victim = &s;
+            }
+        }
+
+        if (match) {
+            if (match->client->connected() && millis() - match->lastUsed > HTTP_POOL_IDLE_MS) {
+                match->client->stop();
+                _stats.evictions++;
+            }
+            if (!match->client->connected()) makeRoom(match);
+            return match;
+        }
+
+        // Reassign the least recently used slot to the new host
+        if (!victim) return nullptr; // Every slot is mid-request
+        if (victim->client) {
+            delete victim->http; // Stops the socket
+            delete victim->client;
+            victim->http = nullptr;
+            victim->client = nullptr;
+        }
+        if (secure) {
+            victim->client = new ResumableTlsClient(); // No cert verification, as with setInsecure()
+        } else {
+            victim->client = new WiFiClient();
+        }
+        victim->http = new HTTPClient();
+        victim->host = host;
+        victim->port = port;
+        victim->secure = secure;
+        victim->lastUsed = millis();
+        makeRoom(victim);
+        return victim;
+    }
+
+    // A new TLS session needs a large contiguous block; close idle sockets
+    // (oldest first) until there is enough.
+    void makeRoom(Slot* keep) {
+        while (ESP.getMaxAllocHeap() < HTTP_POOL_MIN_HEAP) {
+            Slot* oldest = nullptr;
+            for (Slot& s : _slots) {
+                if (&s == keep || s.busy || !s.client || !s.client->connected()) continue;
+                if (!oldest || s.lastUsed < oldest->lastUsed) oldest = &s;
+            }
+            if (!oldest) return;
+            oldest->client->stop();
+            _stats.evictions++;
+        }
+    }
+
+    void countConnect(Slot* slot, bool reused, bool reconnect = false) {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        if (reused) {
+            _stats.hits++;
+        } else {
+            _stats.misses++;
+            if (slot->secure) _stats.handshakes++;
+        }
+        if (reconnect) _stats.reconnects++;
+        xSemaphoreGive(_lock);
+    }
+
+    static bool parseUrl(const String& url, bool& secure, String& host, uint16_t& port) {
+        int start;
+        if (url.startsWith("https://")) { secure = true; start = 8; port = 443; }
+        else if (url.startsWith("http://")) { secure = false; start = 7; port = 80; }
+        else return false;
+
+        int end = url.indexOf('/', start);
+        if (end < 0) end = url.length();
+        host = url.substring(start, end);
+
+        int colon = host.indexOf(':');
+        if (colon >= 0) {
+            port = host.substring(colon + 1).toInt();
+            host = host.substring(0, colon);
+        }
+        return host.length() > 0;
+    }
+};
+
+extern HttpPool httpPool;
+
+#endif
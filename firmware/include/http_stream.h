@@ -0,0 +1,137 @@
+#ifndef HTTP_STREAM_H
+#define HTTP_STREAM_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+// Wraps the raw socket behind HTTPClient::getStreamPtr() and exposes only the
+// response body. Decodes "Transfer-Encoding: chunked" on the fly and stops at
+// Content-Length, so the connection is left clean for keep-alive reuse.
+class HttpBodyStream : public Stream {
+public:
+    HttpBodyStream(WiFiClient* client, bool chunked, int contentLength, uint32_t timeoutMs = 15000)
+        : _client(client), _chunked(chunked), _contentLeft(contentLength), _timeoutMs(timeoutMs) {}
+
+    int available() override {
+        if (_done || !_client) return 0;
+        if (_peeked >= 0) return 1;
+        int avail = _client->available();
+        if (_chunked && _chunkLeft > 0 && avail > _chunkLeft) return _chunkLeft;
+        if (!_chunked && _contentLeft >= 0 && avail > _contentLeft) return _contentLeft;
+        return avail;
+    }
+
+    int read() override {
+        if (_peeked >= 0) {
+            int c = _peeked;
+            _peeked = -1;
+            return c;
+        }
+        return nextByte();
+    }
+
+    int peek() override {
+        if (_peeked < 0) _peeked = nextByte();
+        return _peeked;
+    }
+
+    size_t write(uint8_t) override { return 0; }
+    void flush() {}
+
+    // True once the terminating chunk (or Content-Length) has been consumed
+    bool finished() const { return _done; }
+
+    // Discards the rest of the body (e.g. whitespace after a parsed JSON
+    // document) so the connection can be reused
+    void drain() {
+        while (read() >= 0) {}
+    }
+
+private:
+    WiFiClient* _client;
+    bool _chunked;
+    int _contentLeft;     // -1 = unknown, read until close
+    uint32_t _timeoutMs;
+    int _chunkLeft = 0;
+    int _peeked = -1;
+    bool _done = false;
+
+    int nextByte() {
+        if (_done || !_client) return -1;
+
+        if (_chunked && _chunkLeft == 0 && !nextChunk()) {
+            _done = true;
+            return -1;
+        }
+        if (!_chunked && _contentLeft == 0) {
+            _done = true;
+            return -1;
+        }
+
+        int c = rawRead();
+        if (c < 0) {
+            _done = true;
+            return -1;
+        }
+
+        if (_chunked) {
+            if (--_chunkLeft == 0) {
+                // Each chunk is followed by CRLF
+                rawRead();
+                rawRead();
+            }
+        } else if (_contentLeft > 0) {
+            _contentLeft--;
+        }
+        return c;
+    }
+
+    // Parses "<hex-size>[;ext]\r\n". Returns false on the final 0-size chunk.
+    bool nextChunk() {
+        int size = 0;
+        bool haveDigits = false;
+        bool inExtension = false;
+        int c;
+        while ((c = rawRead()) >= 0 && c != '\n') {
+            if (inExtension || c == '\r') continue;
+            if (c == ';') { inExtension = true; continue; }
+            int v = -1;
+            if (c >= '0' && c <= '9') v = c - '0';
+            else if (c >= 'a' && c <= 'f') v = c - 'a' + 10;
+            else if (c >= 'A' && c <= 'F') v = c - 'A' + 10;
+            if (v < 0) continue;
+            size = size * 16 + v;
+            haveDigits = true;
+        }
+        if (c < 0 || !haveDigits) return false;
+
+        if (size == 0) {
+            // Skip optional trailers up to the blank line
+            int lineLen = 0;
+            while ((c = rawRead()) >= 0) {
+                if (c == '\n') {
+                    if (lineLen == 0) break;
+                    lineLen = 0;
+                } else if (c != '\r') {
+                    lineLen++;
+                }
+            }
+            return false;
+        }
+
+        _chunkLeft = size;
+        return true;
+    }
+
+    int rawRead() {
+        unsigned long start = millis();
+        while (!_client->available()) {
+            if (!_client->connected()) return -1;
+            if (millis() - start > _timeoutMs) return -1;
+            delay(1);
+        }
+        return _client->read();
+    }
+};
+
+#endif
@@ -0,0 +1,363 @@
+#ifndef INTENT_MATCHER_H
+#define INTENT_MATCHER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include "file_system.h"
+#include "tools.h"
+#include "agent_response.h"
+
+#define INTENTS_PATH "/intents.json"
+#define INTENT_MAX_WORDS 24
+#define INTENT_MAX_CAPTURES 4
+#define INTENT_INPUT_MAX 160        // Longer messages are never simple commands
+
+// Rules written on first boot; edit /intents.json on the device to change them.
+//
+// Each rule lists "match" patterns, a "tool" with "args", and a "reply"
+// template. Patterns are matched word by word against the whole lowercased
+// message with punctuation stripped, so they should start with the command
+// itself rather than "*" ("is pin 2 on" must not match "* pin {pin#} on"):
+//   word      literal word            a|b      either word
+//   word?     optional word           *        any run of words (may be empty)
+//   {name}    captures one word       {name#}  captures a number
+// Args and replies substitute {name} captures; replies also take {result}
+// (raw tool output), {result.key} (field of a JSON object result) and
+// {result[].key} (field of every element of a JSON array result, joined).
+static constexpr char INTENTS_DEFAULT[] PROGMEM = R"json([
+ {"name": "gpio_on",
+  "match": ["please? turn|switch on the? led? on? pin {pin#} please?", "please? turn|switch pin {pin#} on please?",
+            "please? set pin {pin#} high|on", "pin {pin#} on"],
+  "tool": "gpio_control", "args": {"pin": "{pin}", "mode": "output", "state": 1},
+  "reply": "Done. {result}."},
+ {"name": "gpio_off",
+  "match": ["please? turn|switch off the? led? on? pin {pin#} please?", "please? turn|switch pin {pin#} off please?",
+            "please? set pin {pin#} low|off", "pin {pin#} off"],
+  "tool": "gpio_control", "args": {"pin": "{pin}", "mode": "output", "state": 0},
+  "reply": "Done. {result}."},
+ {"name": "gpio_read",
+  "match": ["please? read|check pin {pin#}", "state of pin {pin#}"],
+  "tool": "gpio_control", "args": {"pin": "{pin}", "mode": "input"},
+  "reply": "Pin {pin} reads {result}."},
+ {"name": "system_stats",
+  "match": ["please? show? system stats|status|info", "please? show? free memory|heap"],
+  "tool": "get_system_stats", "args": {},
+  "reply": "Free heap: {result.heap_free} bytes (largest block {result.heap_max_alloc}), CPU at {result.cpu_freq_mhz} MHz, up for {result.uptime_seconds} s."},
+ {"name": "wifi_scan",
+  "match": ["please? scan wifi|networks", "please? scan for? wifi? networks", "wifi scan"],
+  "tool": "wifi_scan", "args": {},
+  "reply": "Strongest networks nearby: {result[].ssid}."},
+ {"name": "script_run",
+  "match": ["please? run|start|play script|routine {name}", "please? run|start|play the? {name} script|routine"],
+  "tool": "script_run", "args": {"name": "{name}"},
+  "reply": "{result}."},
+ {"name": "script_stop",
+  "match": ["please? stop all the? scripts", "please? stop every script"],
+  "tool": "script_stop", "args": {"all": true},
+  "reply": "{result}."},
+ {"name": "memory_read",
+  "match": ["please? show|read your? memory"],
+  "tool": "memory_read", "args": {},
+  "reply": "Here is what I remember:\n{result}"}
+])json";
+
+// Answers common commands ("turn on pin 2", "system stats", "scan wifi")
+// on-device: the message is matched against rules from /intents.json and the
+// tool runs directly, with a templated reply and no LLM round trip.
+// Anything that does not match a rule falls through to the provider.
+class IntentMatcher {
+public:
+    struct Stats {
+        uint32_t hits = 0;
+        uint32_t misses = 0;
+    };
+
+    IntentMatcher() { _lock = xSemaphoreCreateMutex(); }
+
+    void begin() {
+        if (!LittleFS.exists(INTENTS_PATH)) {
+            fsManager.writeFile(INTENTS_PATH, INTENTS_DEFAULT);
+        }
+        load();
+    }
+
+    // Re-reads /intents.json. Returns the number of rules loaded.
+    // Safe to call from the CLI while the agent worker is matching.
+    int load() {
+        String json = fsManager.readFile(INTENTS_PATH);
+        DynamicJsonDocument* rules = new DynamicJsonDocument(json.length() * 2 + 512);
+        DeserializationError err = deserializeJson(*rules, json);
+        if (err || !rules->is<JsonArray>()) {
+            Serial.println("Intents: " INTENTS_PATH " invalid, local commands disabled");
+            rules->clear();
+        }
+
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        delete _rules;
+        _rules = rules;
+        size_t count = ruleCount();
+        xSemaphoreGive(_lock);
+
+        Serial.printf("Intents: %u rules\n", (unsigned)count);
+        return count;
+    }
+
+    size_t ruleCount() const { return _rules ? _rules->as<JsonArrayConst>().size() : 0; }
+    const Stats& stats() const { return _stats; }
+
+    // Runs the first matching rule. On a match, out holds the reply and tool
+    // result and true is returned.
+    bool handle(const String& message, Tools& tools, AgentResponse& out) {
+        if (!_rules) return false;
+
+        char buf[INTENT_INPUT_MAX];
+        const char* words[INTENT_MAX_WORDS];
+        int count = tokenize(message.c_str(), buf, sizeof(buf), words, INTENT_MAX_WORDS);
+        if (count <= 0 || message.indexOf('?') >= 0 || isQuestionOrNegation(words, count) || isCompound(words, count)) {
+            _stats.misses++;
+            return false;
+        }
+
+        bool matched = false;
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        for (JsonObject rule : _rules->as<JsonArray>()) {
+            for (const char* pattern : rule["match"].as<JsonArray>()) {
+                Captures caps;
+                if (!pattern || !matchPattern(pattern, words, count, caps)) continue;
+                run(rule, caps, tools, out);
+                matched = true;
+                break;
+            }
+            if (matched) break;
+        }
+        xSemaphoreGive(_lock);
+
+        if (matched) _stats.hits++;
+        else _stats.misses++;
+        return matched;
+    }
+
+private:
+    struct Captures {
+        const char* name[INTENT_MAX_CAPTURES];
+        size_t nameLen[INTENT_MAX_CAPTURES];
+        const char* value[INTENT_MAX_CAPTURES];
+        int count = 0;
+
+        const char* find(const char* key, size_t len) const {
+            for (int i = 0; i < count; i++) {
+                if (nameLen[i] == len && strncmp(name[i], key, len) == 0) return value[i];
+            }
+            return nullptr;
+        }
+    };
+
+    DynamicJsonDocument* _rules = nullptr;
+    Stats _stats;
+    SemaphoreHandle_t _lock;
+
+    void run(JsonObject rule, const Captures& caps, Tools& tools, AgentResponse& out) {
+        const char* name = rule["name"] | "intent";
+        const char* tool = rule["tool"] | "none";
+
+        // Args with captures substituted; a whole-value numeric capture stays a number
+        DynamicJsonDocument args(512);
+        JsonObject argsObj = args.to<JsonObject>();
+        for (JsonPair kv : rule["args"].as<JsonObject>()) {
+            const char* v = kv.value().as<const char*>();
+            if (!v) {
+                argsObj[kv.key()] = kv.value();
+                continue;
+            }
+            String expanded = expand(v, caps, nullptr, nullptr);
+            if (v[0] == '{' && isNumber(expanded.c_str())) argsObj[kv.key()] = expanded.toInt();
+            else argsObj[kv.key()] = expanded;
+        }
+
+        String toolResult = strcmp(tool, "none") == 0 ? String() : tools.execute(String(tool), argsObj);
+
+        DynamicJsonDocument resultDoc(toolResult.length() * 2 + 256);
+        bool resultIsJson = !deserializeJson(resultDoc, toolResult);
+        bool resolved = true;
+        String reply = expand(rule["reply"] | "{result}", caps, &toolResult,
+                              resultIsJson ? &resultDoc : nullptr, &resolved);
+        if (!resolved) reply = toolResult; // Template did not fit this result (e.g. an error string)
+
+        Serial.printf("Intent '%s' answered locally\n", name);
+
+        out.reply = reply;
+        out.thought = String("Handled on-device by intent '") + name + "'";
+        out.tool = strcmp(tool, "none") == 0 ? "" : tool;
+        out.toolResult = toolResult;
+    }
+
+    // Replaces {capture}, {result}, {result.key} and {result[].key} in tmpl
+    static String expand(const char* tmpl, const Captures& caps, const String* result,
+                         JsonDocument* resultDoc, bool* resolved = nullptr) {
+        String out;
+        for (const char* p = tmpl; *p; p++) {
+            const char* close = *p == '{' ? strchr(p, '}') : nullptr;
+            if (!close) {
+                out += *p;
+                continue;
+            }
+            const char* key = p + 1;
+            size_t len = close - key;
+            p = close;
+
+            if (const char* cap = caps.find(key, len)) {
+                out += cap;
+            } else if (result && len == 6 && strncmp(key, "result", 6) == 0) {
+                out += *result;
+            } else if (result && len > 7 && len < 40 && strncmp(key, "result.", 7) == 0) {
+                char field[32];
+                memcpy(field, key + 7, len - 7);
+                field[len - 7] = '\0';
+                JsonVariant v = resultDoc ? (*resultDoc)[field] : JsonVariant();
+                if (v.isNull()) { if (resolved) *resolved = false; continue; }
+                out += v.as<String>();
+            } else if (result && len > 9 && len < 42 && strncmp(key, "result[].", 9) == 0) {
+                char field[32];
+                memcpy(field, key + 9, len - 9);
+                field[len - 9] = '\0';
+                JsonArray arr = resultDoc ? resultDoc->as<JsonArray>() : JsonArray();
+                if (arr.isNull()) { if (resolved) *resolved = false; continue; }
+                bool first = true;
+                for (JsonVariant item : arr) {
+                    if (!first) out += ", ";
+                    out += item[field].as<String>();
+                    first = false;
+                }
+            } else {
+                for (const char* c = key - 1; c <= close; c++) out += *c; // Unknown placeholder, keep as written
+            }
+        }
+        return out;
+    }
+
+    // Lowercases into buf, splits on anything that is not a letter or digit
+    static int tokenize(const char* in, char* buf, size_t cap, const char** words, int maxWords) {
+        size_t n = 0;
+        int count = 0;
+        bool inWord = false;
+        for (; *in && n + 1 < cap; in++) {
+            char c = tolower((unsigned char)*in);
+            if (isalnum((unsigned char)c)) {
+                if (!inWord) {
+                    if (count == maxWords) return -1;
+                    words[count++] = buf + n;
+                    inWord = true;
+                }
+                buf[n++] = c;
+            } else if (inWord) {
+                buf[n++] = '\0';
+                inWord = false;
+            }
+        }
+        if (*in) return -1; // Too long to be a simple command
+        buf[n] = '\0';
+        return count;
+    }
+
+    // "turn on pin 2 and blink pin 4": leave multi-step requests to the model
+    static bool isCompound(const char** words, int count) {
+        static const char* joiners[] = {"and", "then", "but", "if", "when", "after", "before", "while"};
+        for (int i = 0; i < count; i++) {
+            for (const char* j : joiners) {
+                if (strcmp(words[i], j) == 0) return true;
+            }
+        }
+        return false;
+    }
+
+    // "is pin 2 on", "how do I turn on pin 2", "don't stop the scripts": a
+    // question or a negation is never a command, whatever words it contains
+    static bool isQuestionOrNegation(const char** words, int count) {
+        static const char* questions[] = {"is", "are", "what", "how", "why", "can", "could", "does", "do",
+                                          "did", "should", "would", "will", "which", "where", "when", "who"};
+        static const char* negations[] = {"dont", "not", "never", "no", "doesnt", "cant", "wont"};
+        for (const char* q : questions) {
+            if (strcmp(words[0], q) == 0) return true;
+        }
+        for (int i = 0; i < count; i++) {
+            for (const char* n : negations) {
+                if (strcmp(words[i], n) == 0) return true;
+            }
+            // "don't" and friends tokenize as "don" "t"
+            if (i + 1 < count && strcmp(words[i + 1], "t") == 0) return true;
+        }
+        return false;
+    }
+
+    static bool isNumber(const char* s) {
+        if (!*s) return false;
+        for (; *s; s++) {
+            if (!isdigit((unsigned char)*s)) return false;
+        }
+        return true;
+    }
+
+    static bool matchPattern(const char* pattern, const char** words, int count, Captures& caps) {
+        caps.count = 0;
+        return matchFrom(pattern, words, count, caps);
+    }
+
+    // Backtracking match of the pattern's remaining tokens against words
+    static bool matchFrom(const char* p, const char** words, int count, Captures& caps) {
+        while (*p == ' ') p++;
+        if (!*p) return count == 0;
+
+        const char* end = p;
+        while (*end && *end != ' ') end++;
+        size_t len = end - p;
+
+        if (len == 1 && *p == '*') {
+            for (int skip = 0; skip <= count; skip++) {
+                int saved = caps.count;
+                if (matchFrom(end, words + skip, count - skip, caps)) return true;
+                caps.count = saved;
+            }
+            return false;
+        }
+
+        bool optional = p[len - 1] == '?';
+        if (optional) len--;
+
+        if (count > 0 && tokenMatches(p, len, words[0], caps)) {
+            int saved = caps.count;
+            if (matchFrom(end, words + 1, count - 1, caps)) return true;
+            caps.count = saved;
+        }
+        return optional && matchFrom(end, words, count, caps);
+    }
+
+    static bool tokenMatches(const char* tok, size_t len, const char* word, Captures& caps) {
+        if (tok[0] == '{' && tok[len - 1] == '}') {
+            bool numeric = len > 2 && tok[len - 2] == '#';
+            if (numeric && !isNumber(word)) return false;
+            if (caps.count >= INTENT_MAX_CAPTURES) return false;
+            caps.name[caps.count] = tok + 1;
+            caps.nameLen[caps.count] = len - 2 - (numeric ? 1 : 0);
+            caps.value[caps.count] = word;
+            caps.count++;
+            return true;
+        }
+
+        // Alternatives separated by '|'
+        size_t wlen = strlen(word);
+        const char* alt = tok;
+        const char* stop = tok + len;
+        while (alt < stop) {
+            const char* bar = alt;
+            while (bar < stop && *bar != '|') bar++;
+            if ((size_t)(bar - alt) == wlen && strncmp(alt, word, wlen) == 0) return true;
+            alt = bar + 1;
+        }
+        return false;
+    }
+};
+
+extern IntentMatcher intents;
+
+#endif
@@ -0,0 +1,461 @@
+#ifndef MEMORY_INDEX_H
+#define MEMORY_INDEX_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include <math.h>
+#include <algorithm>
+#include "memory_store.h"
+#include "prompt_builder.h"
+
+#define MEMORY_INDEX_PATH "/MEMORY.idx"
+#define MEMORY_INDEX_MAX_ENTRIES 512    // Entry id must fit in 9 bits
+#define MEMORY_INDEX_MAX_POSTINGS 3072  // 4 bytes each
+#define MEMORY_INDEX_MAX_QUERY_TERMS 16
+#define MEMORY_INDEX_MAX_K 16
+#define MEMORY_INDEX_MAGIC 0x4D494458   // "MIDX"
+#define MEMORY_INDEX_VERSION 3
+#define MEMORY_INDEX_RECORD_MAGIC 0x4A44494D  // "MIDJ"
+#define MEMORY_INDEX_COMPACT_RECORDS 32 // Appended records before the file is rewritten
+
+// BM25 keyword index over MEMORY.md, one entry per line. Terms are hashed to
+// 16 bits and postings packed as (hash:16 | entry:9 | tf:7), kept sorted by
+// hash so a term's postings are one binary search away. MEMORY.idx holds a
+// snapshot followed by one appended record per memory_write (its new entries
+// and postings), so a write costs a few dozen bytes of flash, not the whole
+// index. Records are replayed on load and folded into a fresh snapshot once
+// there are MEMORY_INDEX_COMPACT_RECORDS of them. The index is only rebuilt
+// from MEMORY.md when the two disagree or capacity runs out. A mutex guards
+// the tables, as the agent worker reads and adds while the console may
+// rebuild.
+class MemoryIndex {
+public:
+    MemoryIndex() { _lock = xSemaphoreCreateMutex(); }
+
+    void begin() {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        if (!_entries) {
+            _entries = (Entry*)malloc(sizeof(Entry) * MEMORY_INDEX_MAX_ENTRIES);
+            _postings = (uint32_t*)malloc(sizeof(uint32_t) * MEMORY_INDEX_MAX_POSTINGS);
+            if (!_entries || !_postings) {
+                Serial.println("MemoryIndex: allocation failed");
+                xSemaphoreGive(_lock);
+                return;
+            }
+        }
+        if (!load()) reindex();
+        Serial.printf("MemoryIndex: %u entries, %u postings\n", (unsigned)_entryCount, (unsigned)_postingCount);
+        xSemaphoreGive(_lock);
+    }
+
+    // Indexes text just appended to MEMORY.md at `offset` (one entry per line)
+    void add(size_t offset, const char* text) {
+        if (!_entries) return;
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        if (_fileSize >= offset + strlen(text)) {
+            xSemaphoreGive(_lock); // A rebuild in between already took it in
+            return;
+        }
+        size_t firstNew = _entryCount;
+        const char* line = text;
+        while (*line) {
+            const char* end = strchr(line, '\n');
+            size_t len = end ? (size_t)(end - line) : strlen(line);
+            if (!indexEntry(offset + (line - text), line, len, len)) {
+                // Out of room: start over from the file, keeping the newest entries
+                reindex();
+                xSemaphoreGive(_lock);
+                return;
+            }
+            if (!end) break;
+            line = end + 1;
+        }
+        _fileSize = memoryStore.fileSize();
+        if (_records >= MEMORY_INDEX_COMPACT_RECORDS || !appendRecord(firstNew)) save();
+        xSemaphoreGive(_lock);
+    }
+
+    // Writes the top-k entries for `query` into the prompt (chronological
+    // order, newline separated) without exceeding `budget` bytes of source
+    // text. If fewer than k entries match, the most recent ones fill in.
+    // Returns the number of entries written.
+    int appendRelevant(PromptBuilder& prompt, const char* query, int k, size_t budget) {
+        if (!_entries || k <= 0) return 0;
+        if (k > MEMORY_INDEX_MAX_K) k = MEMORY_INDEX_MAX_K;
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        int written = selectRelevant(prompt, query, k, budget);
+        xSemaphoreGive(_lock);
+        return written;
+    }
+
+    size_t entryCount() const { return _entryCount; }
+    size_t postingCount() const { return _postingCount; }
+
+    // Re-indexes MEMORY.md from scratch, keeping the newest entries that fit
+    void rebuild() {
+        if (!_entries) return;
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        reindex();
+        xSemaphoreGive(_lock);
+    }
+
+private:
+    struct Entry {
+        uint32_t offset;  // Byte offset of the line in MEMORY.md
+        uint16_t len;     // Line length (without newline)
+        uint16_t terms;   // Indexed term count, for BM25 length normalisation
+    };
+
+    static constexpr float BM25_K1 = 1.2f;
+    static constexpr float BM25_B = 0.75f;
+
+    Entry* _entries = nullptr;
+    uint32_t* _postings = nullptr;
+    size_t _entryCount = 0;
+    size_t _postingCount = 0;
+    uint32_t _totalTerms = 0;
+    size_t _fileSize = 0;       // MEMORY.md size the index describes
+    size_t _records = 0;        // Records appended after the snapshot in MEMORY.idx
+    SemaphoreHandle_t _lock;
+
+    // appendRelevant() proper; caller holds _lock
+    int selectRelevant(PromptBuilder& prompt, const char* query, int k, size_t budget) {
+        if (_entryCount == 0) return 0;
+
+        uint16_t terms[MEMORY_INDEX_MAX_QUERY_TERMS];
+        int termCount = 0;
+        forEachTerm(query, strlen(query), [&](uint16_t h) {
+            for (int i = 0; i < termCount; i++) if (terms[i] == h) return;
+            if (termCount < MEMORY_INDEX_MAX_QUERY_TERMS) terms[termCount++] = h;
+        });
+
+        // Score candidates; only entries containing a query term get a slot
+        uint16_t ids[MEMORY_INDEX_MAX_K];
+        float scores[MEMORY_INDEX_MAX_K];
+        int found = 0;
+        float avgLen = _entryCount ? (float)_totalTerms / _entryCount : 1.0f;
+        if (avgLen < 1.0f) avgLen = 1.0f;
+
+        // Sparse accumulator: walk each term's postings once
+        float* acc = (float*)calloc(_entryCount, sizeof(float));
+        if (!acc) return 0;
+        for (int t = 0; t < termCount; t++) {
+            size_t first = lowerBound(terms[t]);
+            size_t last = first;
+            while (last < _postingCount && postingHash(_postings[last]) == terms[t]) last++;
+            size_t df = last - first;
+            if (df == 0) continue;
+            float idf = logf(1.0f + (_entryCount - df + 0.5f) / (df + 0.5f));
+            for (size_t p = first; p < last; p++) {
+                uint16_t id = postingEntry(_postings[p]);
+                float tf = postingTf(_postings[p]);
+                float norm = 1.0f - BM25_B + BM25_B * _entries[id].terms / avgLen;
+                acc[id] += idf * tf * (BM25_K1 + 1.0f) / (tf + BM25_K1 * norm);
+            }
+        }
+        for (uint16_t id = 0; id < _entryCount; id++) {
+            if (acc[id] <= 0.0f) continue;
+            insertTop(ids, scores, found, k, id, acc[id]);
+        }
+        free(acc);
+
+        // Recency fallback
+        for (int id = _entryCount - 1; id >= 0 && found < k; id--) {
+            bool seen = false;
+            for (int i = 0; i < found; i++) if (ids[i] == id) seen = true;
+            if (!seen) insertTop(ids, scores, found, k, id, 0.0f);
+        }
+
+        // Emit in file order so the model sees a coherent timeline. Entries
+        // are copied in pieces, so long ones arrive whole.
+        std::sort(ids, ids + found);
+        char piece[256];
+        size_t used = 0;
+        int written = 0;
+        for (int i = 0; i < found; i++) {
+            const Entry& e = _entries[ids[i]];
+            if (used + e.len > budget) continue;
+            size_t copied = 0;
+            while (copied < e.len) {
+                size_t n = memoryStore.copyRange(e.offset + copied, e.len - copied, piece, sizeof(piece));
+                if (n == 0) break;
+                prompt.text(piece);
+                copied += n;
+            }
+            if (copied == 0) continue;
+            prompt.text("\n");
+            used += copied;
+            written++;
+        }
+        return written;
+    }
+
+    // Caller holds _lock
+    void reindex() {
+        // Count lines so the oldest ones can be skipped
+        size_t lines = 0;
+        File file = LittleFS.open(MEMORY_PATH, "r");
+        if (!file) return;
+        while (file.available()) {
+            if (file.read() == '\n') lines++;
+        }
+        file.close();
+
+        // Leave headroom so the next few appends don't trigger another rebuild
+        size_t keep = MEMORY_INDEX_MAX_ENTRIES * 3 / 4;
+        size_t skip = lines > keep ? lines - keep : 0;
+        while (!indexFrom(skip) && skip < lines) {
+            skip += (lines - skip) / 4 + 1; // Postings ran out: drop more old lines
+        }
+
+        _fileSize = memoryStore.fileSize();
+        save();
+    }
+
+    // Indexes every line after the first `skip`; false if capacity ran out
+    bool indexFrom(size_t skip) {
+        _entryCount = 0;
+        _postingCount = 0;
+        _totalTerms = 0;
+
+        File file = LittleFS.open(MEMORY_PATH, "r");
+        if (!file) return true;
+        char buf[256];
+        size_t offset = 0;
+        size_t lineNo = 0;
+        bool ok = true;
+        while (ok && file.available()) {
+            size_t start = offset;
+            size_t kept = 0;    // Only the start of a long line is tokenized
+            int c;
+            while ((c = file.read()) >= 0) {
+                offset++;
+                if (c == '\n') break;
+                if (kept < sizeof(buf) - 1) buf[kept++] = (char)c;
+            }
+            if (lineNo++ < skip) continue;
+            size_t len = offset - start - (c == '\n' ? 1 : 0);
+            ok = indexEntry(start, buf, kept, len);
+        }
+        file.close();
+        return ok;
+    }
+
+    static uint16_t postingHash(uint32_t p) { return p >> 16; }
+    static uint16_t postingEntry(uint32_t p) { return (p >> 7) & 0x1FF; }
+    static uint8_t postingTf(uint32_t p) { return p & 0x7F; }
+
+    // Tokenizes textLen bytes of text; len is the whole line's length
+    bool indexEntry(size_t offset, const char* text, size_t textLen, size_t len) {
+        if (_entryCount >= MEMORY_INDEX_MAX_ENTRIES) return false;
+
+        // Collect this entry's distinct terms with their frequencies
+        uint16_t hashes[48];
+        uint8_t tfs[48];
+        int distinct = 0;
+        uint16_t total = 0;
+        forEachTerm(text, textLen, [&](uint16_t h) {
+            total++;
+            for (int i = 0; i < distinct; i++) {
+                if (hashes[i] == h) {
+                    if (tfs[i] < 0x7F) tfs[i]++;
+                    return;
+                }
+            }
+            if (distinct < 48) {
+                hashes[distinct] = h;
+                tfs[distinct++] = 1;
+            }
+        });
+        if (total == 0) return true; // Blank line, nothing to find
+        if (_postingCount + distinct > MEMORY_INDEX_MAX_POSTINGS) return false;
+
+        uint16_t id = _entryCount++;
+        _entries[id].offset = offset;
+        _entries[id].len = len > 0xFFFF ? 0xFFFF : len;
+        _entries[id].terms = total;
+        _totalTerms += total;
+
+        for (int i = 0; i < distinct; i++) {
+            insertPosting(((uint32_t)hashes[i] << 16) | ((uint32_t)id << 7) | tfs[i]);
+        }
+        return true;
+    }
+
+    // Sorted insert, after any postings of the same hash; caller checks capacity
+    void insertPosting(uint32_t p) {
+        uint16_t hash = postingHash(p);
+        size_t at = lowerBound(hash);
+        while (at < _postingCount && postingHash(_postings[at]) == hash) at++;
+        memmove(_postings + at + 1, _postings + at, (_postingCount - at) * sizeof(uint32_t));
+        _postings[at] = p;
+        _postingCount++;
+    }
+
+    size_t lowerBound(uint16_t hash) const {
+        size_t lo = 0, hi = _postingCount;
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (postingHash(_postings[mid]) < hash) lo = mid + 1;
+            else hi = mid;
+        }
+        return lo;
+    }
+
+    static void insertTop(uint16_t* ids, float* scores, int& found, int k, uint16_t id, float score) {
+        int pos = found;
+        while (pos > 0 && scores[pos - 1] < score) pos--;
+        if (pos >= k) return;
+        int end = found < k ? found : k - 1;
+        for (int i = end; i > pos; i--) {
+            ids[i] = ids[i - 1];
+            scores[i] = scores[i - 1];
+        }
+        ids[pos] = id;
+        scores[pos] = score;
+        if (found < k) found++;
+    }
+
+    // Lower-cased alphanumeric runs of 2+ chars, minus common stopwords, as 16-bit FNV-1a
+    template <typename F>
+    static void forEachTerm(const char* text, size_t len, F emit) {
+        char word[24];
+        size_t w = 0;
+        for (size_t i = 0; i <= len; i++) {
+            char c = i < len ? text[i] : ' ';
+            if (isalnum((unsigned char)c)) {
+                if (w < sizeof(word) - 1) word[w++] = tolower((unsigned char)c);
+                continue;
+            }
+            if (w >= 2) {
+                word[w] = '\0';
+                if (!isStopword(word)) {
+                    uint32_t h = 2166136261u;
+                    for (size_t j = 0; j < w; j++) h = (h ^ (uint8_t)word[j]) * 16777619u;
+                    emit((uint16_t)(h ^ (h >> 16)));
+                }
+            }
+            w = 0;
+        }
+    }
+
+    static bool isStopword(const char* w) {
+        static const char* const stop[] = {
+            "the", "and", "is", "are", "was", "to", "of", "in", "on", "at", "it", "its",
+            "an", "be", "for", "with", "that", "this", "as", "by", "or", "me", "my", "you", "your"
+        };
+        for (const char* s : stop) {
+            if (strcmp(w, s) == 0) return true;
+        }
+        return false;
+    }
+
+    struct Header {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t entryCount;
+        uint32_t postingCount;
+        uint32_t totalTerms;
+        uint32_t fileSize;
+    };
+
+    // Follows the snapshot once per add(): the entries it indexed, then
+    // their postings
+    struct Record {
+        uint32_t magic;
+        uint16_t entryCount;
+        uint16_t postingCount;
+        uint32_t fileSize;      // MEMORY.md size after this add
+    };
+
+    bool load() {
+        if (!LittleFS.exists(MEMORY_INDEX_PATH)) return false;
+        File f = LittleFS.open(MEMORY_INDEX_PATH, "r");
+        if (!f) return false;
+
+        Header h;
+        bool ok = f.read((uint8_t*)&h, sizeof(h)) == sizeof(h) &&
+                  h.magic == MEMORY_INDEX_MAGIC && h.version == MEMORY_INDEX_VERSION &&
+                  h.entryCount <= MEMORY_INDEX_MAX_ENTRIES && h.postingCount <= MEMORY_INDEX_MAX_POSTINGS;
+        if (ok) {
+            size_t eBytes = sizeof(Entry) * h.entryCount;
+            size_t pBytes = sizeof(uint32_t) * h.postingCount;
+            ok = f.read((uint8_t*)_entries, eBytes) == eBytes &&
+                 f.read((uint8_t*)_postings, pBytes) == pBytes;
+        }
+        if (ok) {
+            _entryCount = h.entryCount;
+            _postingCount = h.postingCount;
+            _totalTerms = h.totalTerms;
+            _fileSize = h.fileSize;
+            _records = 0;
+        }
+
+        // Replay appended records; a torn last record fails the load
+        while (ok && f.available()) {
+            Record r;
+            ok = f.read((uint8_t*)&r, sizeof(r)) == sizeof(r) && r.magic == MEMORY_INDEX_RECORD_MAGIC &&
+                 _entryCount + r.entryCount <= MEMORY_INDEX_MAX_ENTRIES &&
+                 _postingCount + r.postingCount <= MEMORY_INDEX_MAX_POSTINGS;
+            if (!ok) break;
+            size_t eBytes = sizeof(Entry) * r.entryCount;
+            ok = f.read((uint8_t*)(_entries + _entryCount), eBytes) == eBytes;
+            for (uint16_t i = 0; ok && i < r.entryCount; i++) _totalTerms += _entries[_entryCount + i].terms;
+            for (uint16_t i = 0; ok && i < r.postingCount; i++) {
+                uint32_t p;
+                ok = f.read((uint8_t*)&p, sizeof(p)) == sizeof(p) &&
+                     postingEntry(p) >= _entryCount && postingEntry(p) < _entryCount + r.entryCount;
+                if (ok) insertPosting(p);
+            }
+            _entryCount += r.entryCount;
+            _fileSize = r.fileSize;
+            _records++;
+        }
+        f.close();
+        if (!ok || _fileSize != memoryStore.fileSize()) return false; // MEMORY.md edited behind our back?
+
+        if (_records >= MEMORY_INDEX_COMPACT_RECORDS) save();
+        return true;
+    }
+
+    // Appends the entries from firstNew on, and their postings, as one record
+    bool appendRecord(size_t firstNew) {
+        File f = LittleFS.open(MEMORY_INDEX_PATH, "a");
+        if (!f) return false;
+        uint16_t postings = 0;
+        for (size_t i = 0; i < _postingCount; i++) {
+            if (postingEntry(_postings[i]) >= firstNew) postings++;
+        }
+        Record r = {MEMORY_INDEX_RECORD_MAGIC, (uint16_t)(_entryCount - firstNew), postings, (uint32_t)_fileSize};
+        size_t expected = sizeof(r) + sizeof(Entry) * r.entryCount + sizeof(uint32_t) * postings;
+        size_t n = f.write((const uint8_t*)&r, sizeof(r));
+        n += f.write((const uint8_t*)(_entries + firstNew), sizeof(Entry) * r.entryCount);
+        for (size_t i = 0; i < _postingCount; i++) {
+            if (postingEntry(_postings[i]) >= firstNew) n += f.write((const uint8_t*)&_postings[i], sizeof(uint32_t));
+        }
+        f.close();
+        if (n != expected) return false;
+        _records++;
+        return true;
+    }
+
+    // Rewrites MEMORY.idx as a single snapshot (compaction)
+    void save() {
+        _records = 0;
+        File f = LittleFS.open(MEMORY_INDEX_PATH, "w");
+        if (!f) {
+            Serial.println("MemoryIndex: save failed");
+            return;
+        }
+        Header h = {MEMORY_INDEX_MAGIC, MEMORY_INDEX_VERSION, (uint16_t)_entryCount,
+                    (uint32_t)_postingCount, _totalTerms, (uint32_t)_fileSize};
+        f.write((const uint8_t*)&h, sizeof(h));
+        f.write((const uint8_t*)_entries, sizeof(Entry) * _entryCount);
+        f.write((const uint8_t*)_postings, sizeof(uint32_t) * _postingCount);
+        f.close();
+    }
+};
+
+extern MemoryIndex memoryIndex;
+
+#endif
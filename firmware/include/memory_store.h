@@ -0,0 +1,118 @@
+#ifndef MEMORY_STORE_H
+#define MEMORY_STORE_H
+
+#include <Arduino.h>
+#include <LittleFS.h>
+#include "file_system.h"
+
+#define MEMORY_PATH "/MEMORY.md"
+#define MEMORY_MAX_BYTES 8192   // RAM copy bound; the file itself keeps everything
+
+// Long-term memory (MEMORY.md) held in RAM so the agent hot path never reads
+// flash. Loaded once at boot; appends go to the file and the buffer together
+// (write-through). If the file outgrows the buffer, the RAM copy keeps the
+// newest whole lines.
+class MemoryStore {
+public:
+    void begin() {
+        if (!_buf) {
+            _buf = (char*)malloc(MEMORY_MAX_BYTES);
+            if (!_buf) {
+                Serial.println("Memory: buffer allocation failed");
+                return;
+            }
+        }
+        _len = 0;
+        _buf[0] = '\0';
+
+        if (!LittleFS.exists(MEMORY_PATH)) {
+            fsManager.writeFile(MEMORY_PATH, "MicroClaw Memory initialized.\n");
+        }
+
+        File file = LittleFS.open(MEMORY_PATH, "r");
+        if (!file) return;
+        size_t total = file.size();
+        _fileSize = total;
+        if (total >= MEMORY_MAX_BYTES) {
+            // Skip ahead to the tail, then to the next line start
+            file.seek(total - (MEMORY_MAX_BYTES - 1));
+            file.readStringUntil('\n');
+        }
+        _len = file.read((uint8_t*)_buf, MEMORY_MAX_BYTES - 1);
+        _buf[_len] = '\0';
+        file.close();
+        _version++;
+
+        Serial.printf("Memory: loaded %u bytes\n", (unsigned)_len);
+    }
+
+    // Appends one entry (a newline is added) to MEMORY.md and the RAM copy
+    bool append(const char* entry) {
+        if (!entry || !*entry) return false;
+        size_t n = strlen(entry);
+
+        fsManager.appendFile(MEMORY_PATH, entry);
+        fsManager.appendFile(MEMORY_PATH, "\n");
+        _fileSize += n + 1;
+
+        if (!_buf) return true;
+        if (n + 1 >= MEMORY_MAX_BYTES) {
+            // A single oversized entry: keep only its tail
+            entry += n - (MEMORY_MAX_BYTES - 2);
+            n = MEMORY_MAX_BYTES - 2;
+        }
+        if (_len + n + 1 >= MEMORY_MAX_BYTES) dropOldest(_len + n + 2 - MEMORY_MAX_BYTES);
+
+        memcpy(_buf + _len, entry, n);
+        _len += n;
+        _buf[_len++] = '\n';
+        _buf[_len] = '\0';
+        _version++;
+        return true;
+    }
+
+    const char* c_str() const { return _buf ? _buf : ""; }
+    size_t size() const { return _len; }
+    size_t fileSize() const { return _fileSize; }
+
+    // Copies up to cap-1 bytes of MEMORY.md starting at a file offset. Served
+    // from RAM when the range is inside the cached tail, else read from flash.
+    size_t copyRange(size_t offset, size_t len, char* out, size_t cap) const {
+        if (cap == 0) return 0;
+        if (len > cap - 1) len = cap - 1;
+        size_t windowStart = _fileSize - _len;
+        size_t n = 0;
+        if (_buf && offset >= windowStart && offset + len <= _fileSize) {
+            memcpy(out, _buf + (offset - windowStart), len);
+            n = len;
+        } else {
+            File file = LittleFS.open(MEMORY_PATH, "r");
+            if (file && file.seek(offset)) n = file.read((uint8_t*)out, len);
+            if (file) file.close();
+        }
+        out[n] = '\0';
+        return n;
+    }
+
+    // Bumped on every load/append so dependants can tell their view is stale
+    uint32_t version() const { return _version; }
+
+private:
+    char* _buf = nullptr;
+    size_t _len = 0;
+    size_t _fileSize = 0;
+    uint32_t _version = 0;
+
+    // Removes at least `bytes` from the front, rounded up to a line boundary
+    void dropOldest(size_t bytes) {
+        size_t cut = bytes < _len ? bytes : _len;
+        while (cut < _len && _buf[cut - 1] != '\n') cut++;
+        memmove(_buf, _buf + cut, _len - cut);
+        _len -= cut;
+        _buf[_len] = '\0';
+    }
+};
+
+extern MemoryStore memoryStore;
+
+#endif
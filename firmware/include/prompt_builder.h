@@ -0,0 +1,186 @@
+#ifndef PROMPT_BUILDER_H
+#define PROMPT_BUILDER_H
+
+#include <Arduino.h>
+
+#define PROMPT_ARENA_SIZE 12288      // Upper bound for one prompt, JSON-escaped
+#define PROMPT_SEGMENTS_MAX 12
+
+// Assembles the prompt directly into a fixed, preallocated arena, already
+// JSON-escaped so it can be spliced into a request body as-is. Nothing is
+// reallocated; once the arena is full further text is dropped and
+// truncated() reports it.
+class PromptBuilder {
+public:
+    PromptBuilder(char* arena, size_t capacity) : _buf(arena), _cap(capacity) { reset(); }
+
+    void reset() {
+        _len = 0;
+        _reserve = 0;
+        _truncated = false;
+        _buf[0] = '\0';
+    }
+
+    // Keeps `bytes` free for what must always fit (user message, instructions).
+    // Optional context appended while a reserve is set is cut short instead.
+    void setReserve(size_t bytes) {
+        _reserve = bytes < _cap / 2 ? bytes : _cap / 2;
+    }
+
+    // Appends text, escaping it for a JSON string
+    PromptBuilder& text(const char* s) {
+        return text(s, (size_t)-1);
+    }
+
+    // Appends at most maxBytes of s (cut on a UTF-8 boundary), escaped
+    PromptBuilder& text(const char* s, size_t maxBytes) {
+        if (!s) return *this;
+        const char* end = s;
+        while (*end && (size_t)(end - s) < maxBytes) end++;
+        if (*end) {
+            while (end > s && ((uint8_t)*end & 0xC0) == 0x80) end--;
+        }
+        for (; s < end; s++) {
+            char esc[7];
+            const char* out = esc;
+            size_t n;
+            switch (*s) {
+                case '"':  out = "\\\""; n = 2; break;
+                case '\\': out = "\\\\"; n = 2; break;
+                case '\n': out = "\\n"; n = 2; break;
+                case '\r': out = "\\r"; n = 2; break;
+                case '\t': out = "\\t"; n = 2; break;
+                default:
+                    if ((uint8_t)*s < 0x20) {
+                        snprintf(esc, sizeof(esc), "\\u%04x", (uint8_t)*s);
+                        n = 6;
+                    } else {
+                        esc[0] = *s;
+                        n = 1;
+                    }
+            }
+            if (!put(out, n)) break;
+        }
+        return *this;
+    }
+
+    PromptBuilder& text(const String& s) { return text(s.c_str()); }
+
+    // Appends text that is already JSON-escaped (e.g. flash-resident constants)
+    PromptBuilder& raw(const char* s, size_t n) {
+        put(s, n);
+        return *this;
+    }
+
+    PromptBuilder& raw(const char* s) { return raw(s, strlen(s)); }
+
+    const char* c_str() const { return _buf; }
+    size_t length() const { return _len; }
+    size_t capacity() const { return _cap; }
+    bool truncated() const { return _truncated; }
+
+private:
+    char* _buf;
+    size_t _cap;
+    size_t _len;
+    size_t _reserve;
+    bool _truncated;
+
+    // Escape sequences are written whole or not at all
+    bool put(const char* s, size_t n) {
+        if (_len + n + _reserve + 1 > _cap) {
+            _truncated = true;
+            return false;
+        }
+        memcpy(_buf + _len, s, n);
+        _len += n;
+        _buf[_len] = '\0';
+        return true;
+    }
+};
+
+// Read-only Stream over a list of buffers, used as an HTTP request body so the
+// JSON envelope and the escaped prompt go to the socket without being joined
+// into one String first.
+class SegmentStream : public Stream {
+public:
+    bool add(const char* data, size_t len) {
+        if (_count >= PROMPT_SEGMENTS_MAX) return false;
+        _segs[_count].data = data;
+        _segs[_count].len = len;
+        _count++;
+        _size += len;
+        return true;
+    }
+
+    bool add(const char* data) { return add(data, strlen(data)); }
+
+    size_t size() const { return _size; }
+
+    // Restart from the first byte (the pool may resend the body once)
+    void rewind() {
+        _seg = 0;
+        _off = 0;
+        _consumed = 0;
+    }
+
+    int available() override { return _size - _consumed; }
+
+    int read() override {
+        int c = peek();
+        if (c >= 0) advance(1);
+        return c;
+    }
+
+    int peek() override {
+        skipEmpty();
+        if (_seg >= _count) return -1;
+        return (uint8_t)_segs[_seg].data[_off];
+    }
+
+    size_t readBytes(char* buffer, size_t length) {
+        size_t copied = 0;
+        while (copied < length) {
+            skipEmpty();
+            if (_seg >= _count) break;
+            size_t n = _segs[_seg].len - _off;
+            if (n > length - copied) n = length - copied;
+            memcpy(buffer + copied, _segs[_seg].data + _off, n);
+            copied += n;
+            advance(n);
+        }
+        return copied;
+    }
+
+    size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+
+    size_t write(uint8_t) override { return 0; }
+    void flush() {}
+
+private:
+    struct Segment {
+        const char* data;
+        size_t len;
+    };
+
+    Segment _segs[PROMPT_SEGMENTS_MAX];
+    uint8_t _count = 0;
+    uint8_t _seg = 0;
+    size_t _off = 0;
+    size_t _size = 0;
+    size_t _consumed = 0;
+
+    void skipEmpty() {
+        while (_seg < _count && _off >= _segs[_seg].len) {
+            _seg++;
+            _off = 0;
+        }
+    }
+
+    void advance(size_t n) {
+        _off += n;
+        _consumed += n;
+    }
+};
+
+#endif
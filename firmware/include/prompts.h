@@ -0,0 +1,58 @@
+#ifndef PROMPTS_H
+#define PROMPTS_H
+
+#include <Arduino.h>
+#include "prompt_builder.h"
+
+// Static prompt segments, stored pre-escaped for a JSON string so they are
+// spliced into the request body with PromptBuilder::raw() and never copied
+// to the heap. Being const they live in flash (rodata); PROGMEM is a no-op
+// on ESP32 and only documents intent. Keep the text JSON-escaped by hand.
+
+// Length of a flash string literal without the terminator, known at compile time
+#define FLASH_LEN(s) (sizeof(s) - 1)
+
+static constexpr char PROMPT_PREAMBLE[] PROGMEM =
+    "You are MicroClaw, a physical AI assistant running on an ESP32, created by Abhimanyu Singh. "
+    "You can interact with hardware via GPIOs, scan WiFi, and manage system stats. ";
+
+static constexpr char PROMPT_FOLLOWUP[] PROGMEM =
+    "Based on this hardware data, provide your final friendly reply to the user. Set tool to 'none'.";
+
+// Native function calling (Groq): the tools travel as a schema in the request,
+// so the prompt only states how to answer
+static constexpr char PROMPT_NATIVE_TOOLS[] PROGMEM =
+    "Call the provided functions for any hardware, scan or memory action; otherwise reply to the user in plain text.";
+
+static constexpr char PROMPT_FOLLOWUP_NATIVE[] PROGMEM =
+    "Based on this hardware data, reply to the user in plain, friendly text.";
+
+static constexpr char PROMPT_TOOL_CATALOGUE[] PROGMEM = R"json(Respond with a JSON object: {\"thought\": \"...\", \"tool\": \"tool_name\", \"args\": { ... }, \"reply\": \"...\"}. )json"
+    R"json(Valid tools: 'get_system_stats' {}, 'wifi_scan' {}, 'ble_scan' {}, 'ble_connect' {address: '...'}, 'ble_disconnect' {}, 'memory_write' {content: '...'}, 'memory_read' {}. )json"
+    R"json(To run several independent tools at once, add \"calls\": [{\"tool\": \"...\", \"args\": { ... }}, ...] instead of tool/args. )json"
+    R"json('run_script' { script: [ {cmd: \"gpio\", pin: 2, state: 1}, {cmd: \"gpio_mask\", set: [4, 5], clear: [2]}, {cmd: \"delay\", ms: 1000}, {cmd: \"delay_us\", us: 250}, {cmd: \"loop\", count: 5, steps: [...]} ] }. )json"
+    R"json(Use 'run_script' for ALL hardware control (blinking, patterns, resizing). )json"
+    R"json(IMPORTANT: 'run_script' is NON-BLOCKING. The script runs in the background. )json"
+    R"json(Your reply should be: 'I have started the script...' instead of 'I executed...'. The user will see the action happen immediately after your reply. )json"
+    R"json('gpio_mask' {set: [4, 5], clear: [2]} switches several pins at the same instant. )json"
+    R"json('pulse_count' {pin: 4, gate_ms: 1000, filter_ns: 1000, edge: 'rising'} measures pulse count and frequency (Hz) on an input. )json"
+    R"json('adc_sample' {pin: 34, samples: 2048, rate_hz: 10000, fft: true} summarizes an analog input (min/max/mean/RMS mV, strongest frequency). )json"
+    R"json('script_save' {name: 'blink', script: [...], autostart: false} stores a script; 'script_run' {name: 'blink'} runs a saved one. )json"
+    R"json('script_list' {} shows running and saved scripts; 'script_stop' {id: 3} stops one, {all: true} stops all. )json"
+    R"json('rule_add' {pin: 4, edge: 'rising', debounce_ms: 50, pull: 'up', script: 'blink'} (or tool: 'gpio_control', args: {...} instead of script) reacts to an input on-device; 'rule_list' {}, 'rule_remove' {id: 1}.)json";
+
+// Closing instructions, appended by each provider client after the prompt
+// because they depend on how that provider receives tools. This keeps the
+// prompt in the arena provider-neutral, so a request can fail over as is.
+inline void addInstructions(SegmentStream& body, bool nativeTools, bool followUp) {
+    if (nativeTools) {
+        // Follow-ups go out with tool_choice "none": no call instructions there
+        if (followUp) body.add(PROMPT_FOLLOWUP_NATIVE, FLASH_LEN(PROMPT_FOLLOWUP_NATIVE));
+        else body.add(PROMPT_NATIVE_TOOLS, FLASH_LEN(PROMPT_NATIVE_TOOLS));
+    } else {
+        if (followUp) body.add(PROMPT_FOLLOWUP, FLASH_LEN(PROMPT_FOLLOWUP));
+        body.add(PROMPT_TOOL_CATALOGUE, FLASH_LEN(PROMPT_TOOL_CATALOGUE));
+    }
+}
+
+#endif
@@ -0,0 +1,350 @@
+#ifndef PROVIDER_ROUTER_H
+#define PROVIDER_ROUTER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <functional>
+#include <algorithm>
+#include "prompt_builder.h"
+#include "sse_parser.h"
+#include "config_manager.h"
+#include "agent_response.h"
+
+#define ROUTER_LATENCY_SAMPLES 16
+#define ROUTER_EWMA_ALPHA 0.2f
+#define ROUTER_BREAKER_FAILS 3          // Consecutive failures that open the breaker
+#define ROUTER_COOLDOWN_MS 15000        // First open period; doubles on each failed probe
+#define ROUTER_COOLDOWN_MAX_MS 300000
+#define ROUTER_HEDGE_DEFAULT_MS 4000    // Deadline until enough latency samples exist
+#define ROUTER_HEDGE_MIN_MS 1500
+#define ROUTER_HEDGE_MAX_MS 10000
+#define ROUTER_TASK_STACK 16384         // Hedged attempt: TLS handshake + response parsing
+
+// Chooses between the LLM providers per request. Tracks each provider's
+// health (latency EWMA and p95, error counts, circuit breaker), fails over to
+// the other provider on errors, and can hedge: if the primary has not
+// answered by a p95-based deadline the secondary is started too and the
+// first good answer wins.
+class ProviderRouter {
+public:
+    enum Provider { GROQ = 0, GEMINI = 1, PROVIDER_COUNT = 2 };
+
+    // Runs one completion on a provider; role picks that provider's model
+    typedef std::function<AgentResponse(Provider, const PromptBuilder&, ModelRole, TokenCallback)> CallFn;
+
+    ProviderRouter() { _lock = xSemaphoreCreateMutex(); }
+
+    void begin(CallFn call) { _call = call; }
+
+    void setAvailable(Provider p, bool available) { _health[p].available = available; }
+    void setHedging(bool hedge) { _hedge = hedge; }
+
+    static const char* name(Provider p) { return p == GROQ ? "groq" : "gemini"; }
+
+    AgentResponse generate(const PromptBuilder& prompt, Provider primary, ModelRole role, TokenCallback onToken) {
+        Provider order[PROVIDER_COUNT];
+        int count = plan(primary, order);
+        if (count == 0) return AgentResponse::failure("No AI provider configured");
+
+        if (_hedge && count > 1) {
+            return generateHedged(prompt, order[0], order[1], role, onToken);
+        }
+
+        AgentResponse result;
+        for (int i = 0; i < count; i++) {
+            if (i > 0) {
+                _failovers++;
+                Serial.printf("Router: failing over to %s\n", name(order[i]));
+            }
+            result = timedCall(order[i], prompt, role, onToken);
+            if (!isFailure(result)) break;
+        }
+        return result;
+    }
+
+    String statsJson() {
+        StaticJsonDocument<768> doc;
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        for (int i = 0; i < PROVIDER_COUNT; i++) {
+            const Health& h = _health[i];
+            JsonObject o = doc.createNestedObject(name((Provider)i));
+            o["available"] = h.available;
+            o["ewma_ms"] = (uint32_t)h.ewmaMs;
+            o["p95_ms"] = p95(h);
+            o["ok"] = h.ok;
+            o["errors"] = h.errors;
+            o["breaker"] = h.openUntil == 0 ? "closed" : (millis() < h.openUntil ? "open" : "half-open");
+        }
+        doc["failovers"] = _failovers;
+        doc["hedges"] = _hedges;
+        doc["hedge_wins"] = _hedgeWins;
+        xSemaphoreGive(_lock);
+
+        String output;
+        serializeJson(doc, output);
+        return output;
+    }
+
+private:
+    struct Health {
+        bool available = false;
+        float ewmaMs = 0;
+        uint32_t samples[ROUTER_LATENCY_SAMPLES];
+        uint8_t sampleCount = 0;
+        uint8_t samplePos = 0;
+        uint32_t ok = 0;
+        uint32_t errors = 0;
+        uint8_t consecutiveFails = 0;
+        unsigned long openUntil = 0;     // 0 = breaker closed
+        bool probing = false;            // Half-open and one request is trying it
+        uint32_t cooldownMs = ROUTER_COOLDOWN_MS;
+    };
+
+    // A hedged attempt running on its own task. Owned jointly by that task and
+    // the caller; whichever lets go last frees it, so an abandoned straggler
+    // cleans up after itself. It works on a private copy of the prompt because
+    // the arena is reused by the next request. Tokens of the provider that
+    // does not hold the live stream are kept, in case it turns out to win.
+    struct Attempt {
+        ProviderRouter* router;
+        Provider provider;
+        ModelRole role;
+        char* promptBuf;
+        PromptBuilder* prompt;
+        TokenCallback sink;
+        SemaphoreHandle_t sinkLock; // Orders calls into sink; taken before _lock
+        int tokenOwner = -1;   // First provider to stream tokens has the live stream
+        String held[PROVIDER_COUNT]; // Text of the other one
+        bool closed = false;   // Caller returned: drop any further tokens
+        AgentResponse result;
+        SemaphoreHandle_t done;
+        int refs = 2;
+    };
+
+    Health _health[PROVIDER_COUNT];
+    CallFn _call;
+    SemaphoreHandle_t _lock;
+    bool _hedge = false;
+    uint32_t _failovers = 0;
+    uint32_t _hedges = 0;
+    uint32_t _hedgeWins = 0;
+
+    static bool isFailure(const AgentResponse& result) {
+        return result.failed();
+    }
+
+    // Primary first, then the other one; open breakers are skipped unless
+    // that would leave nothing to try
+    int plan(Provider primary, Provider* order) {
+        Provider candidates[PROVIDER_COUNT] = {primary, primary == GROQ ? GEMINI : GROQ};
+        int count = 0;
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        for (Provider p : candidates) {
+            if (_health[p].available && allows(_health[p])) order[count++] = p;
+        }
+        if (count == 0) {
+            for (Provider p : candidates) {
+                if (_health[p].available) order[count++] = p;
+            }
+        }
+        xSemaphoreGive(_lock);
+        return count;
+    }
+
+    // Closed, or open with the cooldown over and no probe out yet (half-open:
+    // the first call through becomes the probe, see timedCall)
+    static bool allows(const Health& h) {
+        return h.openUntil == 0 || (millis() >= h.openUntil && !h.probing);
+    }
+
+    AgentResponse timedCall(Provider p, const PromptBuilder& prompt, ModelRole role, TokenCallback onToken) {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        Health& h = _health[p];
+        if (h.openUntil != 0 && millis() >= h.openUntil) h.probing = true; // Until record()
+        xSemaphoreGive(_lock);
+
+        unsigned long start = millis();
+        AgentResponse result = _call(p, prompt, role, onToken);
+        record(p, millis() - start, !isFailure(result));
+        return result;
+    }
+
+    void record(Provider p, uint32_t ms, bool success) {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        Health& h = _health[p];
+        h.probing = false;
+        if (success) {
+            h.ok++;
+            h.ewmaMs = h.sampleCount == 0 ? ms : h.ewmaMs + ROUTER_EWMA_ALPHA * (ms - h.ewmaMs);
+            h.samples[h.samplePos] = ms;
+            h.samplePos = (h.samplePos + 1) % ROUTER_LATENCY_SAMPLES;
+            if (h.sampleCount < ROUTER_LATENCY_SAMPLES) h.sampleCount++;
+            h.consecutiveFails = 0;
+            h.openUntil = 0;
+            h.cooldownMs = ROUTER_COOLDOWN_MS;
+        } else {
+            h.errors++;
+            h.consecutiveFails++;
+            bool probeFailed = h.openUntil != 0;
+            if (probeFailed || h.consecutiveFails >= ROUTER_BREAKER_FAILS) {
+                if (probeFailed && h.cooldownMs < ROUTER_COOLDOWN_MAX_MS) h.cooldownMs *= 2;
+                h.openUntil = millis() + h.cooldownMs;
+                if (h.openUntil == 0) h.openUntil = 1;
+                Serial.printf("Router: %s breaker open for %lus\n", name(p), (unsigned long)(h.cooldownMs / 1000));
+            }
+        }
+        xSemaphoreGive(_lock);
+    }
+
+    // Caller holds _lock
+    static uint32_t p95(const Health& h) {
+        if (h.sampleCount == 0) return 0;
+        uint32_t sorted[ROUTER_LATENCY_SAMPLES];
+        memcpy(sorted, h.samples, h.sampleCount * sizeof(uint32_t));
+        std::sort(sorted, sorted + h.sampleCount);
+        return sorted[(h.sampleCount * 95 + 99) / 100 - 1];
+    }
+
+    uint32_t hedgeDeadline(Provider p) {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        const Health& h = _health[p];
+        uint32_t deadline = h.sampleCount < 5 ? ROUTER_HEDGE_DEFAULT_MS : p95(h) * 3 / 2;
+        xSemaphoreGive(_lock);
+        if (deadline < ROUTER_HEDGE_MIN_MS) deadline = ROUTER_HEDGE_MIN_MS;
+        if (deadline > ROUTER_HEDGE_MAX_MS) deadline = ROUTER_HEDGE_MAX_MS;
+        return deadline;
+    }
+
+    AgentResponse generateHedged(const PromptBuilder& prompt, Provider primary, Provider secondary,
+                          ModelRole role, TokenCallback onToken) {
+        Attempt* a = startAttempt(prompt, primary, role, onToken);
+        if (!a) {
+            // No memory for a second task: plain failover instead
+            AgentResponse result = timedCall(primary, prompt, role, onToken);
+            if (!isFailure(result)) return result;
+            _failovers++;
+            return timedCall(secondary, prompt, role, onToken);
+        }
+
+        AgentResponse result;
+        Provider winner = primary;
+        if (xSemaphoreTake(a->done, pdMS_TO_TICKS(hedgeDeadline(primary))) == pdTRUE) {
+            result = a->result; // Answered in time (or failed fast)
+            if (isFailure(result)) {
+                _failovers++;
+                winner = secondary;
+                result = timedCall(secondary, prompt, role, gated(a, secondary));
+            }
+        } else {
+            _hedges++;
+            Serial.printf("Router: %s slow, hedging with %s\n", name(primary), name(secondary));
+            result = timedCall(secondary, prompt, role, gated(a, secondary));
+            if (isFailure(result)) {
+                xSemaphoreTake(a->done, portMAX_DELAY); // Secondary failed; the primary is all we have
+                result = a->result;
+            } else {
+                _hedgeWins++;
+                winner = secondary;
+            }
+        }
+
+        close(a, winner);
+        release(a);
+        return result;
+    }
+
+    // Ends the live stream. If the winner is not the provider whose text was
+    // shown, that text is discarded and the winner's held text takes its place.
+    void close(Attempt* a, Provider winner) {
+        if (!a->sink) return;
+        xSemaphoreTake(a->sinkLock, portMAX_DELAY);
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        a->closed = true;
+        bool replace = a->tokenOwner >= 0 && a->tokenOwner != winner;
+        String text = replace ? a->held[winner] : String();
+        xSemaphoreGive(_lock);
+        if (replace) {
+            a->sink(nullptr);
+            if (text.length()) a->sink(text.c_str());
+        }
+        xSemaphoreGive(a->sinkLock);
+    }
+
+    Attempt* startAttempt(const PromptBuilder& prompt, Provider p, ModelRole role, TokenCallback onToken) {
+        char* buf = (char*)malloc(prompt.length() + 1);
+        SemaphoreHandle_t done = xSemaphoreCreateBinary();
+        SemaphoreHandle_t sinkLock = xSemaphoreCreateMutex();
+        if (!buf || !done || !sinkLock) {
+            free(buf);
+            if (done) vSemaphoreDelete(done);
+            if (sinkLock) vSemaphoreDelete(sinkLock);
+            return nullptr;
+        }
+
+        Attempt* a = new Attempt();
+        a->router = this;
+        a->provider = p;
+        a->role = role;
+        a->promptBuf = buf;
+        a->prompt = new PromptBuilder(buf, prompt.length() + 1);
+        a->prompt->raw(prompt.c_str(), prompt.length());
+        a->sink = onToken;
+        a->sinkLock = sinkLock;
+        a->done = done;
+
+        if (xTaskCreate(attemptTask, "hedge", ROUTER_TASK_STACK, a, 1, nullptr) != pdPASS) {
+            a->refs = 1;
+            release(a);
+            return nullptr;
+        }
+        return a;
+    }
+
+    static void attemptTask(void* arg) {
+        Attempt* a = (Attempt*)arg;
+        ProviderRouter* r = a->router;
+        AgentResponse result = r->timedCall(a->provider, *a->prompt, a->role, r->gated(a, a->provider));
+        xSemaphoreTake(r->_lock, portMAX_DELAY);
+        a->result = result;
+        xSemaphoreGive(r->_lock);
+        xSemaphoreGive(a->done);
+        r->release(a);
+        vTaskDelete(NULL);
+    }
+
+    // Token callback that forwards only for the provider that streamed first
+    // and holds back the other's text, until the caller has returned. The
+    // sink runs outside _lock, so it never stalls stats or other requests.
+    TokenCallback gated(Attempt* a, Provider p) {
+        if (!a->sink) return nullptr;
+        return [this, a, p](const char* token) {
+            xSemaphoreTake(a->sinkLock, portMAX_DELAY);
+            xSemaphoreTake(_lock, portMAX_DELAY);
+            bool forward = false;
+            if (!a->closed) {
+                if (a->tokenOwner < 0) a->tokenOwner = p;
+                forward = a->tokenOwner == p;
+                if (!forward) a->held[p] += token;
+            }
+            xSemaphoreGive(_lock);
+            if (forward) a->sink(token);
+            xSemaphoreGive(a->sinkLock);
+        };
+    }
+
+    void release(Attempt* a) {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        bool last = --a->refs == 0;
+        xSemaphoreGive(_lock);
+        if (!last) return;
+        delete a->prompt;
+        free(a->promptBuf);
+        vSemaphoreDelete(a->done);
+        vSemaphoreDelete(a->sinkLock);
+        delete a;
+    }
+};
+
+extern ProviderRouter router;
+
+#endif
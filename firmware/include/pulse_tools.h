@@ -0,0 +1,116 @@
+#ifndef PULSE_TOOLS_H
+#define PULSE_TOOLS_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <esp_timer.h>
+#include <driver/pcnt.h>
+#include "gpio_tools.h"
+
+#define PULSE_UNIT PCNT_UNIT_0
+#define PULSE_WRAP 30000             // Counter resets here; the ISR adds it to the total
+#define PULSE_GATE_DEFAULT_MS 1000
+#define PULSE_GATE_MAX_MS 10000
+#define PULSE_FILTER_MAX_NS 12787    // 1023 APB cycles at 80 MHz, the PCNT filter limit
+
+// Counts edges on an input pin with the PCNT peripheral for a gate time.
+// The hardware counts by itself, so signals of tens of kHz (flow meters,
+// encoders, tachometers) are measured with no CPU cost beyond one interrupt
+// every PULSE_WRAP pulses. The glitch filter drops pulses shorter than
+// filter_ns. One unit is shared, so measurements run one at a time.
+class PulseTools {
+public:
+    // edge: "rising", "falling" or "both". Returns
+    // {"pin", "edge", "count", "gate_ms", "hz"}, hz being the signal frequency
+    // (with "both", two edges make one period).
+    static String measure(int pin, long gateMs, long filterNs, const char* edge) {
+        if (!GpioTools::isValidInputPin(pin)) return "Error: Invalid Input Pin " + String(pin);
+        if (gateMs <= 0 || gateMs > PULSE_GATE_MAX_MS) return "Error: gate_ms must be 1-" + String(PULSE_GATE_MAX_MS);
+        if (filterNs < 0 || filterNs > PULSE_FILTER_MAX_NS) return "Error: filter_ns must be 0-" + String(PULSE_FILTER_MAX_NS);
+        bool rising = strcmp(edge, "rising") == 0;
+        bool falling = strcmp(edge, "falling") == 0;
+        bool both = strcmp(edge, "both") == 0;
+        if (!rising && !falling && !both) return String("Error: Unknown edge '") + edge + "'";
+
+        xSemaphoreTake(lock(), portMAX_DELAY);
+        if (!setup(pin, rising || both, falling || both, filterNs)) {
+            xSemaphoreGive(lock());
+            return "Error: Pulse counter unavailable";
+        }
+        pcnt_counter_clear(PULSE_UNIT);
+        wraps() = 0;
+        int64_t start = esp_timer_get_time();
+        pcnt_counter_resume(PULSE_UNIT);
+        vTaskDelay(pdMS_TO_TICKS(gateMs));
+        pcnt_counter_pause(PULSE_UNIT);
+        int64_t elapsedUs = esp_timer_get_time() - start;
+        int16_t value = 0;
+        pcnt_get_counter_value(PULSE_UNIT, &value);
+        uint32_t count = wraps() * PULSE_WRAP + (uint32_t)value;
+        xSemaphoreGive(lock());
+
+        StaticJsonDocument<192> doc;
+        doc["pin"] = pin;
+        doc["edge"] = edge;
+        doc["count"] = count;
+        doc["gate_ms"] = (uint32_t)(elapsedUs / 1000);
+        doc["hz"] = elapsedUs > 0 ? (double)count * 1000000.0 / elapsedUs / (both ? 2 : 1) : 0.0;
+        String output;
+        serializeJson(doc, output);
+        return output;
+    }
+
+private:
+    static SemaphoreHandle_t lock() {
+        static SemaphoreHandle_t mutex = xSemaphoreCreateMutex();
+        return mutex;
+    }
+
+    // Times the counter reached PULSE_WRAP during the current gate
+    static volatile uint32_t& wraps() {
+        static volatile uint32_t count = 0;
+        return count;
+    }
+
+    static void IRAM_ATTR onWrap(void*) {
+        wraps() = wraps() + 1;
+    }
+
+    // Routes pin to the unit, paused; caller holds lock()
+    static bool setup(int pin, bool countRising, bool countFalling, long filterNs) {
+        pcnt_config_t cfg = {};
+        cfg.pulse_gpio_num = pin;
+        cfg.ctrl_gpio_num = PCNT_PIN_NOT_USED;
+        cfg.lctrl_mode = PCNT_MODE_KEEP;
+        cfg.hctrl_mode = PCNT_MODE_KEEP;
+        cfg.pos_mode = countRising ? PCNT_COUNT_INC : PCNT_COUNT_DIS;
+        cfg.neg_mode = countFalling ? PCNT_COUNT_INC : PCNT_COUNT_DIS;
+        cfg.counter_h_lim = PULSE_WRAP;
+        cfg.counter_l_lim = -1;
+        cfg.unit = PULSE_UNIT;
+        cfg.channel = PCNT_CHANNEL_0;
+        GpioTools::invalidatePin(pin); // PCNT makes it an input with a pull-up
+        if (pcnt_unit_config(&cfg) != ESP_OK) return false;
+        pcnt_counter_pause(PULSE_UNIT);
+
+        if (filterNs > 0) {
+            long cycles = filterNs * (APB_CLK_FREQ / 1000000) / 1000;
+            pcnt_set_filter_value(PULSE_UNIT, (uint16_t)(cycles > 1023 ? 1023 : cycles));
+            pcnt_filter_enable(PULSE_UNIT);
+        } else {
+            pcnt_filter_disable(PULSE_UNIT);
+        }
+
+        static bool isrInstalled = false;
+        if (!isrInstalled) {
+            esp_err_t err = pcnt_isr_service_install(0);
+            if (err != ESP_OK && err != ESP_ERR_INVALID_STATE) return false; // Already installed is fine
+            if (pcnt_isr_handler_add(PULSE_UNIT, onWrap, nullptr) != ESP_OK) return false;
+            isrInstalled = true;
+        }
+        pcnt_event_enable(PULSE_UNIT, PCNT_EVT_H_LIM);
+        return true;
+    }
+};
+
+#endif
@@ -0,0 +1,301 @@
+#ifndef RULE_ENGINE_H
+#define RULE_ENGINE_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include <functional>
+#include <esp_timer.h>
+#include "file_system.h"
+#include "gpio_tools.h"
+#include "script_library.h"
+
+#define RULES_PATH "/rules.json"
+#define RULES_MAX 8
+#define RULE_QUEUE_DEPTH 16
+#define RULE_TASK_STACK 6144        // Actions (tools, script loading) run on this stack
+#define RULE_TASK_PRIORITY 2        // Above scripts and the agent, so reactions are prompt
+#define RULE_DEBOUNCE_DEFAULT_MS 50
+
+// On-device reactions: "when input X changes, do Y". Each rule attaches a
+// GPIO interrupt to one input pin. The ISR only debounces, timestamps and
+// queues the edge; a dedicated task then runs the rule's action, either a
+// saved script or a tool call. Rules live in /rules.json:
+//   [{"id": 1, "pin": 4, "edge": "rising|falling|change", "debounce_ms": 50,
+//     "pull": "up|down|none", "script": "blink"}                 // or
+//    {..., "tool": "gpio_control", "args": {"pin": 2, "mode": "output", "state": 1}}]
+class RuleEngine {
+public:
+    // Runs a tool action; supplied by main so this header need not know Tools
+    // (and so main decides which tools a rule may call)
+    typedef std::function<String(const String& tool, JsonObject args)> ToolRunner;
+
+    RuleEngine() { _lock = xSemaphoreCreateMutex(); }
+
+    bool begin(ToolRunner runTool) {
+        _runTool = runTool;
+        _queue = xQueueCreate(RULE_QUEUE_DEPTH, sizeof(Event));
+        if (!_queue) return false;
+        load();
+        return xTaskCreatePinnedToCore(taskEntry, "rules", RULE_TASK_STACK, this,
+                                       RULE_TASK_PRIORITY, nullptr, 1) == pdPASS;
+    }
+
+    // Re-reads /rules.json and re-attaches every rule. Returns the rule count.
+    int load() {
+        String json = fsManager.readFile(RULES_PATH);
+        DynamicJsonDocument doc(json.length() * 2 + 256);
+        if (json.length() && (deserializeJson(doc, json) || !doc.is<JsonArray>())) {
+            Serial.println("Rules: " RULES_PATH " invalid, no rules active");
+            doc.clear();
+        }
+
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        for (Rule& r : _rules) detach(r);
+        int count = 0;
+        for (JsonObject o : doc.as<JsonArray>()) {
+            String error;
+            if (count == RULES_MAX || !parse(o, _rules[count], error)) {
+                Serial.println("Rules: skipped rule " + String(o["id"].as<uint32_t>()) + " " + error);
+                continue;
+            }
+            if (_rules[count].id > _nextId) _nextId = _rules[count].id;
+            count++;
+        }
+        for (int i = 0; i < count; i++) attach(_rules[i], i);
+        xSemaphoreGive(_lock);
+
+        Serial.printf("Rules: %d active\n", count);
+        return count;
+    }
+
+    // Validates and stores a rule given as in /rules.json (without "id")
+    String add(JsonObject spec) {
+        Rule rule;
+        String error;
+        if (!parse(spec, rule, error)) return error;
+
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        int slot = -1;
+        for (int i = 0; i < RULES_MAX; i++) {
+            if (_rules[i].active && _rules[i].pin == rule.pin) {
+                error = "Error: Pin " + String(rule.pin) + " already has rule " + String(_rules[i].id);
+            } else if (!_rules[i].active && slot < 0) {
+                slot = i;
+            }
+        }
+        if (error.length() == 0 && slot < 0) error = "Error: " + String(RULES_MAX) + " rules already defined";
+        if (error.length()) {
+            xSemaphoreGive(_lock);
+            return error;
+        }
+        rule.id = ++_nextId;
+        _rules[slot] = rule;
+        attach(_rules[slot], slot);
+        save();
+        xSemaphoreGive(_lock);
+        String action = rule.tool;
+        if (rule.script.length()) action = "script " + rule.script;
+        return "Rule " + String(rule.id) + " added: pin " + String(rule.pin) + " " + edgeName(rule.edge) + " -> " + action;
+    }
+
+    bool remove(uint32_t id) {
+        bool found = false;
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        for (Rule& r : _rules) {
+            if (r.active && r.id == id) {
+                detach(r);
+                found = true;
+            }
+        }
+        if (found) save();
+        xSemaphoreGive(_lock);
+        return found;
+    }
+
+    // Active rules with how often each fired and when it last did
+    String listJson() {
+        DynamicJsonDocument doc(2048);
+        JsonArray list = doc.to<JsonArray>();
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        for (const Rule& r : _rules) {
+            if (!r.active) continue;
+            JsonObject o = list.createNestedObject();
+            toJson(r, o);
+            o["fired"] = (uint32_t)r.fired;
+            o["dropped"] = (uint32_t)r.dropped;
+            int64_t lastUs = r.lastUs;
+            if (lastUs) o["last_s_ago"] = (uint32_t)((esp_timer_get_time() - lastUs) / 1000000);
+        }
+        xSemaphoreGive(_lock);
+
+        String output;
+        serializeJson(doc, output);
+        return output;
+    }
+
+private:
+    enum Edge : uint8_t { EDGE_RISING, EDGE_FALLING, EDGE_CHANGE };
+    enum Pull : uint8_t { PULL_NONE, PULL_UP, PULL_DOWN };
+
+    struct Rule {
+        bool active = false;
+        uint32_t id = 0;
+        int pin = -1;
+        Edge edge = EDGE_CHANGE;
+        Pull pull = PULL_NONE;
+        uint32_t debounceUs = 0;
+        String script;
+        String tool;
+        String args;                  // Serialized args object for tool actions
+        // Touched by the ISR
+        RuleEngine* engine = nullptr;
+        uint8_t slot = 0;
+        volatile int64_t lastUs = 0;
+        volatile uint32_t fired = 0;
+        volatile uint32_t dropped = 0;
+    };
+
+    struct Event {
+        uint8_t slot;
+        uint8_t level;
+        uint32_t id;                  // Ignored if the slot was reused meanwhile
+    };
+
+    Rule _rules[RULES_MAX];
+    ToolRunner _runTool;
+    SemaphoreHandle_t _lock;
+    QueueHandle_t _queue = nullptr;
+    uint32_t _nextId = 0;
+
+    static const char* edgeName(Edge e) {
+        return e == EDGE_RISING ? "rising" : (e == EDGE_FALLING ? "falling" : "change");
+    }
+
+    static bool parse(JsonObject o, Rule& r, String& error) {
+        r = Rule();
+        r.id = o["id"] | 0;
+        r.pin = o["pin"] | -1;
+        if (!GpioTools::isValidInputPin(r.pin)) {
+            error = "Error: Invalid Input Pin " + String(r.pin);
+            return false;
+        }
+        const char* edge = o["edge"] | "change";
+        if (strcmp(edge, "rising") == 0) r.edge = EDGE_RISING;
+        else if (strcmp(edge, "falling") == 0) r.edge = EDGE_FALLING;
+        else if (strcmp(edge, "change") == 0) r.edge = EDGE_CHANGE;
+        else {
+            error = String("Error: Unknown edge '") + edge + "'";
+            return false;
+        }
+        const char* pull = o["pull"] | "none";
+        r.pull = strcmp(pull, "up") == 0 ? PULL_UP : (strcmp(pull, "down") == 0 ? PULL_DOWN : PULL_NONE);
+        long debounce = o["debounce_ms"] | (long)RULE_DEBOUNCE_DEFAULT_MS;
+        r.debounceUs = debounce < 0 ? 0 : (uint32_t)debounce * 1000;
+
+        r.script = o["script"] | "";
+        r.tool = o["tool"] | "";
+        if (r.script.length() == 0 && r.tool.length() == 0) {
+            error = "Error: A rule needs a script or a tool";
+            return false;
+        }
+        JsonObject args = o["args"];
+        if (r.tool.length() && !args.isNull()) serializeJson(args, r.args);
+        r.active = true;
+        return true;
+    }
+
+    static void toJson(const Rule& r, JsonObject o) {
+        o["id"] = r.id;
+        o["pin"] = r.pin;
+        o["edge"] = edgeName(r.edge);
+        o["debounce_ms"] = r.debounceUs / 1000;
+        o["pull"] = r.pull == PULL_UP ? "up" : (r.pull == PULL_DOWN ? "down" : "none");
+        if (r.script.length()) o["script"] = r.script;
+        if (r.tool.length()) {
+            o["tool"] = r.tool;
+            o["args"] = serialized(r.args.length() ? r.args : String("{}"));
+        }
+    }
+
+    // Caller holds _lock
+    void save() {
+        DynamicJsonDocument doc(2048);
+        JsonArray list = doc.to<JsonArray>();
+        for (const Rule& r : _rules) {
+            if (r.active) toJson(r, list.createNestedObject());
+        }
+        String json;
+        serializeJson(doc, json);
+        fsManager.writeFile(RULES_PATH, json.c_str());
+    }
+
+    // Caller holds _lock
+    void attach(Rule& r, int slot) {
+        r.engine = this;
+        r.slot = slot;
+        GpioTools::invalidatePin(r.pin);
+        pinMode(r.pin, r.pull == PULL_UP ? INPUT_PULLUP : (r.pull == PULL_DOWN ? INPUT_PULLDOWN : INPUT));
+        int mode = r.edge == EDGE_RISING ? RISING : (r.edge == EDGE_FALLING ? FALLING : CHANGE);
+        attachInterruptArg(digitalPinToInterrupt(r.pin), onEdge, &r, mode);
+    }
+
+    // Caller holds _lock
+    void detach(Rule& r) {
+        if (!r.active) return;
+        detachInterrupt(digitalPinToInterrupt(r.pin));
+        r.active = false;
+    }
+
+    // Debounce, timestamp and hand off; everything else happens on the task
+    static void IRAM_ATTR onEdge(void* arg) {
+        Rule* r = (Rule*)arg;
+        int64_t now = esp_timer_get_time();
+        if (r->lastUs && now - r->lastUs < (int64_t)r->debounceUs) return;
+        r->lastUs = now;
+        r->fired++;
+
+        // Input registers read directly: driver calls may live in flash
+        uint32_t in = r->pin < 32 ? GPIO.in >> r->pin : GPIO.in1.data >> (r->pin - 32);
+        Event ev = {r->slot, (uint8_t)(in & 1), r->id};
+        BaseType_t woken = pdFALSE;
+        if (xQueueSendFromISR(r->engine->_queue, &ev, &woken) != pdTRUE) r->dropped++;
+        if (woken) portYIELD_FROM_ISR();
+    }
+
+    static void taskEntry(void* arg) {
+        static_cast<RuleEngine*>(arg)->run();
+    }
+
+    void run() {
+        Event ev;
+        for (;;) {
+            if (xQueueReceive(_queue, &ev, portMAX_DELAY) != pdTRUE) continue;
+
+            // Copy the action out so the lock is not held while it runs
+            xSemaphoreTake(_lock, portMAX_DELAY);
+            const Rule& r = _rules[ev.slot];
+            bool current = r.active && r.id == ev.id;
+            String script = r.script;
+            String tool = r.tool;
+            String args = r.args;
+            int pin = r.pin;
+            xSemaphoreGive(_lock);
+            if (!current) continue;
+
+            String result;
+            if (script.length()) {
+                result = scriptLibrary.run(script);
+            } else {
+                DynamicJsonDocument argsDoc(args.length() * 2 + 128);
+                deserializeJson(argsDoc, args);
+                result = _runTool ? _runTool(tool, argsDoc.as<JsonObject>()) : String("Error: No tool runner");
+            }
+            Serial.printf("Rule %u (pin %d %s): %s\n", (unsigned)ev.id, pin, ev.level ? "high" : "low", result.c_str());
+        }
+    }
+};
+
+extern RuleEngine rules;
+
+#endif
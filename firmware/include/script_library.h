@@ -0,0 +1,175 @@
+#ifndef SCRIPT_LIBRARY_H
+#define SCRIPT_LIBRARY_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <LittleFS.h>
+#include "script_vm.h"
+#include "script_manager.h"
+
+#define SCRIPTS_DIR "/scripts"
+#define SCRIPT_NAME_MAX 24
+#define SCRIPT_FLAG_AUTOSTART 0x01
+
+// Named scripts kept on LittleFS so a known routine can be re-run without
+// the model. Each is stored twice: <name>.bin, the compiled image that
+// script_run loads as is, and <name>.json, the source it is recompiled from
+// if a firmware update changes the image layout.
+class ScriptLibrary {
+public:
+    void begin() {
+        if (!LittleFS.exists(SCRIPTS_DIR)) LittleFS.mkdir(SCRIPTS_DIR);
+    }
+
+    // Validates, compiles and stores a script under name (lowercased)
+    String save(const String& rawName, JsonArray script, bool autostart) {
+        String name;
+        if (!normalizeName(rawName, name)) return "Error: Script names are 1-" + String(SCRIPT_NAME_MAX) + " letters, digits, '-' or '_'";
+
+        ScriptProgram* program = new ScriptProgram();
+        String error;
+        bool ok = program->compile(script, error);
+        if (ok) {
+            String source;
+            serializeJson(script, source);
+            File json = LittleFS.open(path(name, ".json"), "w");
+            ok = json && json.print(source) == source.length();
+            if (json) json.close();
+            ok = ok && writeImage(name, *program, autostart ? SCRIPT_FLAG_AUTOSTART : 0);
+            if (!ok) error = "Error: Could not write script '" + name + "'";
+        }
+        size_t steps = program->size();
+        delete program;
+        if (!ok) return error;
+        return "Script '" + name + "' saved (" + String(steps) + " steps" + (autostart ? ", autostart" : "") + ")";
+    }
+
+    // Loads the compiled image and starts it; same result text as run_script
+    String run(const String& rawName) {
+        String name;
+        if (!normalizeName(rawName, name)) return "Error: No saved script '" + rawName + "'";
+        ScriptProgram* program = load(name);
+        if (!program) return "Error: No saved script '" + name + "'";
+
+        String error;
+        uint32_t id = scripts.start(program, error);
+        if (!id) return error;
+        return "Script " + String(id) + " started in background";
+    }
+
+    bool remove(const String& rawName) {
+        String name;
+        if (!normalizeName(rawName, name)) return false;
+        bool removed = LittleFS.remove(path(name, ".bin"));
+        return LittleFS.remove(path(name, ".json")) || removed;
+    }
+
+    // [{"name", "steps", "autostart"}] for every saved script. Built one entry
+    // at a time, so the list has no size limit.
+    String listJson() {
+        String output = "[";
+        File dir = LittleFS.open(SCRIPTS_DIR);
+        if (dir && dir.isDirectory()) {
+            File f;
+            while ((f = dir.openNextFile())) {
+                String file = f.name();
+                if (file.endsWith(".bin")) {
+                    StaticJsonDocument<192> doc;
+                    ScriptProgram::ImageHeader h;
+                    doc["name"] = file.substring(file.lastIndexOf('/') + 1, file.length() - 4);
+                    if (ScriptProgram::readHeader(f, h)) {
+                        doc["steps"] = h.count;
+                        doc["autostart"] = (h.flags & SCRIPT_FLAG_AUTOSTART) != 0;
+                    } else {
+                        doc["steps"] = nullptr; // Recompiled on next run
+                    }
+                    if (output.length() > 1) output += ',';
+                    serializeJson(doc, output);
+                }
+                f.close();
+            }
+        }
+        output += ']';
+        return output;
+    }
+
+    // Starts every script saved with autostart; called once at boot
+    void autostart() {
+        File dir = LittleFS.open(SCRIPTS_DIR);
+        if (!dir || !dir.isDirectory()) return;
+        File f;
+        while ((f = dir.openNextFile())) {
+            String file = f.name();
+            ScriptProgram::ImageHeader h;
+            bool start = file.endsWith(".bin") && ScriptProgram::readHeader(f, h) && (h.flags & SCRIPT_FLAG_AUTOSTART);
+            f.close();
+            if (!start) continue;
+            String name = file.substring(file.lastIndexOf('/') + 1, file.length() - 4);
+            Serial.println("Autostart script '" + name + "': " + run(name));
+        }
+    }
+
+private:
+    static bool normalizeName(const String& raw, String& name) {
+        name = raw;
+        name.trim();
+        name.toLowerCase();
+        if (name.length() == 0 || name.length() > SCRIPT_NAME_MAX) return false;
+        for (size_t i = 0; i < name.length(); i++) {
+            char c = name[i];
+            if (!isalnum((unsigned char)c) && c != '-' && c != '_') return false;
+        }
+        return true;
+    }
+
+    static String path(const String& name, const char* ext) {
+        return String(SCRIPTS_DIR "/") + name + ext;
+    }
+
+    static bool writeImage(const String& name, const ScriptProgram& program, uint8_t flags) {
+        File bin = LittleFS.open(path(name, ".bin"), "w");
+        if (!bin) return false;
+        bool ok = program.writeImage(bin, flags);
+        bin.close();
+        return ok;
+    }
+
+    // The stored image, or a fresh compile of the source when the image is
+    // missing or from an older layout (the image is then rewritten)
+    ScriptProgram* load(const String& name) {
+        ScriptProgram* program = new ScriptProgram();
+        uint8_t flags = 0;
+        File bin = LittleFS.open(path(name, ".bin"), "r");
+        bool ok = bin && program->readImage(bin, &flags);
+        if (bin) {
+            // An old image still carries its autostart flag
+            if (!ok) {
+                bin.seek(0);
+                ScriptProgram::ImageHeader h;
+                if (bin.readBytes((char*)&h, sizeof(h)) == sizeof(h) && h.magic == SCRIPT_IMAGE_MAGIC) flags = h.flags;
+            }
+            bin.close();
+        }
+        if (ok) return program;
+
+        File json = LittleFS.open(path(name, ".json"), "r");
+        if (!json) {
+            delete program;
+            return nullptr;
+        }
+        DynamicJsonDocument doc(json.size() * 2 + 256);
+        DeserializationError err = deserializeJson(doc, json);
+        json.close();
+        String error;
+        if (err || !program->compile(doc.as<JsonArray>(), error)) {
+            delete program;
+            return nullptr;
+        }
+        writeImage(name, *program, flags);
+        return program;
+    }
+};
+
+extern ScriptLibrary scriptLibrary;
+
+#endif
@@ -0,0 +1,149 @@
+#ifndef SCRIPT_MANAGER_H
+#define SCRIPT_MANAGER_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "script_vm.h"
+
+#define SCRIPT_SLOTS 4              // Scripts running at the same time
+#define SCRIPT_TASK_STACK 3072      // Interpreter + one log line; no JSON parsing
+#define SCRIPT_PRIORITY_MAX (tskIDLE_PRIORITY + 2)  // Well below WiFi/lwIP (ESP_TASK_TCPIP_PRIO)
+
+// Runs compiled scripts on a fixed pool of slots. Each running script has an
+// id, owns the output pins it drives (a second script touching them is
+// refused) and can be stopped. Tasks are created with the configured core
+// affinity and priority, by default the application core at low priority so
+// a runaway script cannot starve WiFi.
+class ScriptManager {
+public:
+    ScriptManager() { _lock = xSemaphoreCreateMutex(); }
+
+    void setTaskConfig(int core, int priority) {
+        _core = (core == 0 || core == 1) ? core : tskNO_AFFINITY;
+        _priority = priority < 1 ? 1 : (priority > SCRIPT_PRIORITY_MAX ? SCRIPT_PRIORITY_MAX : priority);
+    }
+
+    // Starts a compiled program and takes ownership of it. Returns the
+    // script id, or 0 with the reason in error.
+    uint32_t start(ScriptProgram* program, String& error) {
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        Slot* slot = nullptr;
+        for (Slot& s : _slots) {
+            if (!s.program) {
+                if (!slot) slot = &s;
+                continue;
+            }
+            uint64_t shared = s.pins & program->outputs();
+            if (shared) {
+                error = "Error: Pin " + String(lowestPin(shared)) + " is in use by script " + String(s.id);
+                xSemaphoreGive(_lock);
+                delete program;
+                return 0;
+            }
+        }
+        if (!slot) {
+            xSemaphoreGive(_lock);
+            delete program;
+            error = "Error: " + String(SCRIPT_SLOTS) + " scripts already running; stop one first";
+            return 0;
+        }
+
+        slot->id = ++_nextId;
+        slot->program = program;
+        slot->pins = program->outputs();
+        slot->stop = false;
+        slot->startedAt = millis();
+        slot->manager = this;
+        uint32_t id = slot->id;
+        if (xTaskCreatePinnedToCore(taskEntry, "ScriptTask", SCRIPT_TASK_STACK, slot, _priority,
+                                    &slot->task, _core) != pdPASS) {
+            slot->program = nullptr;
+            id = 0;
+            error = "Error: Not enough memory to start the script";
+        }
+        xSemaphoreGive(_lock);
+        if (!id) delete program;
+        return id;
+    }
+
+    // Stops one script, or all of them for id 0. Returns how many were signalled.
+    int stop(uint32_t id) {
+        int stopped = 0;
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        for (Slot& s : _slots) {
+            if (!s.program || (id != 0 && s.id != id)) continue;
+            s.stop = true;
+            xTaskNotifyGive(s.task); // Wake it from a delay
+            stopped++;
+        }
+        xSemaphoreGive(_lock);
+        return stopped;
+    }
+
+    // [{"id", "steps", "pins": [...], "running_s"}] for every running script
+    String listJson() {
+        StaticJsonDocument<768> doc;
+        JsonArray list = doc.to<JsonArray>();
+        xSemaphoreTake(_lock, portMAX_DELAY);
+        for (const Slot& s : _slots) {
+            if (!s.program) continue;
+            JsonObject o = list.createNestedObject();
+            o["id"] = s.id;
+            o["steps"] = s.program->size();
+            JsonArray pins = o.createNestedArray("pins");
+            for (int pin = 0; pin < 64; pin++) {
+                if (s.pins & (1ULL << pin)) pins.add(pin);
+            }
+            o["running_s"] = (millis() - s.startedAt) / 1000;
+        }
+        xSemaphoreGive(_lock);
+
+        String output;
+        serializeJson(doc, output);
+        return output;
+    }
+
+private:
+    struct Slot {
+        uint32_t id = 0;
+        ScriptProgram* program = nullptr;   // nullptr = free
+        TaskHandle_t task = nullptr;
+        uint64_t pins = 0;
+        volatile bool stop = false;
+        unsigned long startedAt = 0;
+        ScriptManager* manager = nullptr;
+    };
+
+    Slot _slots[SCRIPT_SLOTS];
+    SemaphoreHandle_t _lock;
+    uint32_t _nextId = 0;
+    BaseType_t _core = 1;
+    UBaseType_t _priority = 1;
+
+    static int lowestPin(uint64_t mask) {
+        for (int pin = 0; pin < 64; pin++) {
+            if (mask & (1ULL << pin)) return pin;
+        }
+        return -1;
+    }
+
+    static void taskEntry(void* arg) {
+        Slot* slot = (Slot*)arg;
+        bool finished = slot->program->run(&slot->stop);
+        Serial.printf("Script %u %s\n", (unsigned)slot->id, finished ? "finished" : "stopped");
+
+        // Free the slot under the lock so stop() never notifies a deleted task
+        ScriptManager* manager = slot->manager;
+        xSemaphoreTake(manager->_lock, portMAX_DELAY);
+        delete slot->program;
+        slot->program = nullptr;
+        slot->task = nullptr;
+        slot->pins = 0;
+        xSemaphoreGive(manager->_lock);
+        vTaskDelete(NULL);
+    }
+};
+
+extern ScriptManager scripts;
+
+#endif
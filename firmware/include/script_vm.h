@@ -0,0 +1,308 @@
+#ifndef SCRIPT_VM_H
+#define SCRIPT_VM_H
+
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include <esp_timer.h>
+#include "gpio_tools.h"
+
+#define SCRIPT_MAX_OPS 128         // Compiled instructions per script
+#define SCRIPT_MAX_DEPTH 8         // Nested loops
+#define SCRIPT_MAX_MASKS 16        // gpio_mask steps per script
+#define SCRIPT_SPIN_US 50          // Busy-wait only this close to a deadline
+#define SCRIPT_IMAGE_MAGIC 0x31524353UL  // "SCR1"
+#define SCRIPT_IMAGE_VERSION 1           // Bump when Op, Mask or the header change
+
+// A run_script program compiled once from its JSON form
+// ([{cmd:'gpio',pin,state} | {cmd:'gpio_mask',set:[pins],clear:[pins]} |
+//   {cmd:'delay',ms} | {cmd:'delay_us',us} | {cmd:'loop',count,steps:[...]}])
+// into a flat instruction array. Loops become LOOP/END pairs with jump
+// targets and a counter stack, so running it needs no JSON, no string
+// compares and no recursion however deep the nesting.
+//
+// Delays are scheduled against absolute deadlines measured from the start
+// of the run, so the time spent on GPIO writes, or waiting for the CPU
+// while WiFi is busy, does not accumulate into drift.
+class ScriptProgram {
+public:
+    enum OpCode : uint8_t { OP_GPIO, OP_GPIO_MASK, OP_DELAY, OP_DELAY_US, OP_LOOP, OP_END };
+
+    struct Op {
+        OpCode code;
+        uint8_t pin;       // OP_GPIO
+        uint16_t jump;     // OP_END: first op of the loop body
+        uint32_t value;    // OP_GPIO: level. OP_GPIO_MASK: mask index. OP_DELAY: ms. OP_DELAY_US: us. OP_LOOP: count
+    };
+
+    // Validates and compiles a script. On failure returns false with a
+    // message in error and leaves the program empty.
+    bool compile(JsonArray script, String& error) {
+        _count = 0;
+        _maskCount = 0;
+        _outputs = 0;
+        if (script.isNull()) {
+            error = "Invalid script";
+            return false;
+        }
+        if (!emit(script, 0, error)) {
+            _count = 0;
+            return false;
+        }
+        return true;
+    }
+
+    size_t size() const { return _count; }
+    uint64_t outputs() const { return _outputs; }
+
+    // Compiled image as stored on flash: header, ops, masks
+    struct ImageHeader {
+        uint32_t magic;
+        uint16_t version;
+        uint16_t count;
+        uint8_t maskCount;
+        uint8_t flags;      // Owner-defined (the script library keeps autostart here)
+        uint16_t reserved;
+        uint64_t outputs;
+    };
+
+    bool writeImage(Print& out, uint8_t flags) const {
+        ImageHeader h = {SCRIPT_IMAGE_MAGIC, SCRIPT_IMAGE_VERSION, _count, _maskCount, flags, 0, _outputs};
+        size_t expected = sizeof(h) + _count * sizeof(Op) + _maskCount * sizeof(Mask);
+        size_t n = out.write((const uint8_t*)&h, sizeof(h));
+        n += out.write((const uint8_t*)_ops, _count * sizeof(Op));
+        n += out.write((const uint8_t*)_masks, _maskCount * sizeof(Mask));
+        return n == expected;
+    }
+
+    static bool readHeader(Stream& in, ImageHeader& h) {
+        return in.readBytes((char*)&h, sizeof(h)) == sizeof(h) &&
+               h.magic == SCRIPT_IMAGE_MAGIC && h.version == SCRIPT_IMAGE_VERSION &&
+               h.count <= SCRIPT_MAX_OPS && h.maskCount <= SCRIPT_MAX_MASKS;
+    }
+
+    // Loads an image written by writeImage, without recompiling. Rejects
+    // images from another firmware layout, truncated files, and anything the
+    // compiler could not have produced (bad pins, jumps or loop nesting).
+    bool readImage(Stream& in, uint8_t* flags = nullptr) {
+        ImageHeader h;
+        _count = 0;
+        if (!readHeader(in, h)) return false;
+        size_t opBytes = h.count * sizeof(Op);
+        size_t maskBytes = h.maskCount * sizeof(Mask);
+        if (in.readBytes((char*)_ops, opBytes) != opBytes || in.readBytes((char*)_masks, maskBytes) != maskBytes) {
+            return false;
+        }
+        _maskCount = h.maskCount;
+        _outputs = h.outputs;
+        if (flags) *flags = h.flags;
+        if (!verify(h.count)) return false;
+        _count = h.count;
+        return true;
+    }
+
+    // Runs the program on the calling task until it ends or *stop is set.
+    // Delays wait on the task notification, given by a one-shot timer at the
+    // deadline or by a stop request (set the flag, then notify the task), so
+    // a stop takes effect at once. Returns false if stopped.
+    bool run(volatile bool* stop) const {
+        // Output pins are configured once up front, not on every step
+        GpioTools::configureOutputs(_outputs);
+
+        esp_timer_create_args_t timerArgs = {};
+        timerArgs.callback = onDeadline;
+        timerArgs.arg = xTaskGetCurrentTaskHandle();
+        timerArgs.name = "script";
+        esp_timer_handle_t timer = nullptr;
+        if (esp_timer_create(&timerArgs, &timer) != ESP_OK) return false;
+        bool finished = execute(stop, timer);
+        esp_timer_stop(timer);
+        esp_timer_delete(timer);
+        return finished;
+    }
+
+private:
+    struct Mask {
+        uint64_t set;
+        uint64_t clear;
+    };
+
+    Op _ops[SCRIPT_MAX_OPS];
+    uint16_t _count = 0;
+    Mask _masks[SCRIPT_MAX_MASKS];  // Kept out of Op so every instruction stays 8 bytes
+    uint8_t _maskCount = 0;
+    uint64_t _outputs = 0;   // Bit per GPIO driven by the script
+
+    bool execute(volatile bool* stop, esp_timer_handle_t timer) const {
+        uint32_t counters[SCRIPT_MAX_DEPTH];
+        int depth = 0;
+        uint16_t pc = 0;
+        int64_t deadline = esp_timer_get_time(); // When the current step is due, in us since boot
+        while (pc < _count) {
+            if (*stop) return false;
+            const Op& op = _ops[pc];
+            switch (op.code) {
+                case OP_GPIO:
+                    if (op.value) GpioTools::writeMask(1ULL << op.pin, 0);
+                    else GpioTools::writeMask(0, 1ULL << op.pin);
+                    pc++;
+                    break;
+                case OP_GPIO_MASK:
+                    GpioTools::writeMask(_masks[op.value].set, _masks[op.value].clear);
+                    pc++;
+                    break;
+                case OP_DELAY:
+                    deadline += (int64_t)op.value * 1000;
+                    waitUntil(deadline, timer, stop);
+                    pc++;
+                    break;
+                case OP_DELAY_US:
+                    deadline += op.value;
+                    waitUntil(deadline, timer, stop);
+                    pc++;
+                    break;
+                case OP_LOOP:
+                    counters[depth++] = op.value;
+                    pc++;
+                    break;
+                case OP_END:
+                    if (--counters[depth - 1] > 0) {
+                        pc = op.jump;
+                    } else {
+                        depth--;
+                        pc++;
+                    }
+                    break;
+            }
+        }
+        return true;
+    }
+
+    bool verify(uint16_t count) const {
+        if (_outputs & ~GPIO_OUTPUT_PIN_MASK) return false;
+        uint16_t loopStart[SCRIPT_MAX_DEPTH + 1];
+        int depth = 0;
+        for (uint16_t i = 0; i < count; i++) {
+            const Op& op = _ops[i];
+            switch (op.code) {
+                case OP_GPIO:
+                    if (!(_outputs & (1ULL << (op.pin & 63)))) return false;
+                    break;
+                case OP_GPIO_MASK:
+                    if (op.value >= _maskCount || ((_masks[op.value].set | _masks[op.value].clear) & ~_outputs)) return false;
+                    break;
+                case OP_DELAY:
+                case OP_DELAY_US:
+                    break;
+                case OP_LOOP:
+                    if (depth >= SCRIPT_MAX_DEPTH || op.value == 0) return false;
+                    loopStart[depth++] = i;
+                    break;
+                case OP_END:
+                    if (depth == 0 || op.jump != loopStart[--depth] + 1) return false;
+                    break;
+                default:
+                    return false;
+            }
+        }
+        return depth == 0;
+    }
+
+    static void onDeadline(void* task) {
+        xTaskNotifyGive((TaskHandle_t)task);
+    }
+
+    // Blocks on the task notification until SCRIPT_SPIN_US before the
+    // deadline (a timer gives it; a stop request wakes it early), then spins
+    // only that last stretch so the deadline is met to within a few
+    // microseconds without burning the core. While waiting the task sits one
+    // priority level up, so when the timer fires it preempts the equal
+    // priority loop and agent tasks instead of waiting for the next tick.
+    static void waitUntil(int64_t deadline, esp_timer_handle_t timer, volatile bool* stop) {
+        UBaseType_t priority = uxTaskPriorityGet(NULL);
+        vTaskPrioritySet(NULL, priority + 1);
+        int64_t remaining;
+        while (!*stop && (remaining = deadline - esp_timer_get_time()) > SCRIPT_SPIN_US) {
+            if (esp_timer_start_once(timer, remaining - SCRIPT_SPIN_US) != ESP_OK) {
+                vTaskDelay(1);
+                continue;
+            }
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+            esp_timer_stop(timer); // Woken early by a stop: the timer may still be armed
+        }
+        while (!*stop && esp_timer_get_time() < deadline) {}
+        vTaskPrioritySet(NULL, priority);
+    }
+
+    bool push(const Op& op, String& error) {
+        if (_count >= SCRIPT_MAX_OPS) {
+            error = "Error: Script too long (max " + String(SCRIPT_MAX_OPS) + " steps)";
+            return false;
+        }
+        _ops[_count++] = op;
+        return true;
+    }
+
+    // Recursion here is bounded by SCRIPT_MAX_DEPTH and only happens once, at compile time
+    bool emit(JsonArray steps, int depth, String& error) {
+        for (JsonVariant v : steps) {
+            JsonObject cmd = v.as<JsonObject>();
+            const char* type = cmd["cmd"] | "";
+
+            if (strcmp(type, "gpio") == 0) {
+                int pin = cmd["pin"] | -1;
+                if (!GpioTools::isValidOutputPin(pin)) {
+                    error = "Error: Invalid Output Pin " + String(pin);
+                    return false;
+                }
+                _outputs |= 1ULL << pin;
+                if (!push({OP_GPIO, (uint8_t)pin, 0, (uint32_t)(cmd["state"].as<int>() ? 1 : 0)}, error)) return false;
+            } else if (strcmp(type, "gpio_mask") == 0) {
+                Mask mask = {GpioTools::pinMask(cmd["set"]), GpioTools::pinMask(cmd["clear"])};
+                uint64_t bad = (mask.set | mask.clear) & ~GPIO_OUTPUT_PIN_MASK;
+                if (bad || (mask.set & mask.clear)) {
+                    error = "Error: Invalid gpio_mask pins " + GpioTools::pinList(bad ? bad : mask.set & mask.clear);
+                    return false;
+                }
+                if (_maskCount >= SCRIPT_MAX_MASKS) {
+                    error = "Error: Too many gpio_mask steps (max " + String(SCRIPT_MAX_MASKS) + ")";
+                    return false;
+                }
+                _outputs |= mask.set | mask.clear;
+                _masks[_maskCount] = mask;
+                if (!push({OP_GPIO_MASK, 0, 0, _maskCount++}, error)) return false;
+            } else if (strcmp(type, "delay") == 0) {
+                long ms = cmd["ms"] | 0L;
+                if (ms < 0) {
+                    error = "Error: Negative delay";
+                    return false;
+                }
+                if (!push({OP_DELAY, 0, 0, (uint32_t)ms}, error)) return false;
+            } else if (strcmp(type, "delay_us") == 0) {
+                long us = cmd["us"] | 0L;
+                if (us < 0) {
+                    error = "Error: Negative delay";
+                    return false;
+                }
+                if (!push({OP_DELAY_US, 0, 0, (uint32_t)us}, error)) return false;
+            } else if (strcmp(type, "loop") == 0) {
+                long count = cmd["count"] | 0L;
+                JsonArray body = cmd["steps"].as<JsonArray>();
+                if (count <= 0 || body.size() == 0) continue; // Runs zero times
+                if (depth >= SCRIPT_MAX_DEPTH) {
+                    error = "Error: Loops nested too deep (max " + String(SCRIPT_MAX_DEPTH) + ")";
+                    return false;
+                }
+                uint16_t start = _count;
+                if (!push({OP_LOOP, 0, 0, (uint32_t)count}, error)) return false;
+                if (!emit(body, depth + 1, error)) return false;
+                if (!push({OP_END, 0, (uint16_t)(start + 1), 0}, error)) return false;
+            } else {
+                error = String("Error: Unknown script command '") + type + "'";
+                return false;
+            }
+        }
+        return true;
+    }
+};
+
+#endif
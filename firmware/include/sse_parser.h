@@ -0,0 +1,257 @@
+#ifndef SSE_PARSER_H
+#define SSE_PARSER_H
+
+#include <Arduino.h>
+#include <functional>
+
+// Receives decoded reply text as it streams in from the provider. nullptr
+// means "discard the text so far": the router switched to another answer.
+typedef std::function<void(const char* token)> TokenCallback;
+
+// Reads Server-Sent Events line by line and returns the payload of each
+// "data:" line. Stops at "data: [DONE]". Lines start in a caller-owned
+// buffer; a longer line (a whole tool call arrives in one chunk) moves to a
+// heap buffer that doubles as needed up to maxCap. Only lines beyond maxCap
+// are dropped, and that is logged.
+class SseReader {
+public:
+    SseReader(Stream& in, char* buf, size_t cap, size_t maxCap = 16384)
+        : _in(in), _buf(buf), _cap(cap), _maxCap(maxCap < cap ? cap : maxCap) {}
+
+    ~SseReader() {
+        if (_heap) free(_buf);
+    }
+
+    // Returns the next data payload (NUL-terminated, valid until the next
+    // call), or nullptr once the stream ends.
+    char* next(size_t* len) {
+        while (!_done) {
+            size_t n;
+            if (!readLine(&n)) {
+                _done = true;
+                break;
+            }
+            if (n < 5 || strncmp(_buf, "data:", 5) != 0) continue; // comments, event:, blank separators
+
+            char* data = _buf + 5;
+            if (*data == ' ') data++;
+            size_t dataLen = n - (data - _buf);
+            if (strcmp(data, "[DONE]") == 0) {
+                _done = true;
+                _complete = true;
+                break;
+            }
+            *len = dataLen;
+            return data;
+        }
+        return nullptr;
+    }
+
+    bool done() const { return _done; }
+    // The stream ended with "data: [DONE]" rather than a timeout or close
+    bool complete() const { return _complete; }
+
+private:
+    Stream& _in;
+    char* _buf;
+    size_t _cap;
+    size_t _maxCap;
+    bool _heap = false;
+    bool _done = false;
+    bool _complete = false;
+
+    // Doubles the buffer, moving it to the heap on first use
+    bool grow(size_t used) {
+        if (_cap >= _maxCap) return false;
+        size_t cap = _cap * 2 > _maxCap ? _maxCap : _cap * 2;
+        char* bigger = (char*)(_heap ? realloc(_buf, cap) : malloc(cap));
+        if (!bigger) return false;
+        if (!_heap) memcpy(bigger, _buf, used);
+        _buf = bigger;
+        _cap = cap;
+        _heap = true;
+        return true;
+    }
+
+    // Lines that outgrow maxCap (or the heap) are dropped whole rather than split.
+    bool readLine(size_t* len) {
+        size_t n = 0;
+        bool overflow = false;
+        while (true) {
+            int c = _in.read();
+            if (c < 0) return false;
+            if (c == '\r') continue;
+            if (c == '\n') {
+                if (overflow) {
+                    Serial.printf("SSE: dropped line over %u bytes\n", (unsigned)_cap);
+                    n = 0;
+                    overflow = false;
+                    continue;
+                }
+                _buf[n] = '\0';
+                *len = n;
+                return true;
+            }
+            if (overflow) continue;
+            if (n + 1 >= _cap && !grow(n)) {
+                overflow = true;
+                continue;
+            }
+            _buf[n++] = (char)c;
+        }
+    }
+};
+
+// Incrementally scans the model's JSON answer ({"thought":..,"tool":..,"reply":..})
+// as fragments arrive. Characters of the top-level "reply" string are decoded and
+// forwarded to the callback immediately; "tool" is captured once complete.
+class JsonFieldExtractor {
+public:
+    JsonFieldExtractor(TokenCallback onReply) : _onReply(onReply) {}
+
+    void feed(const char* data, size_t len) {
+        for (size_t i = 0; i < len; i++) step(data[i]);
+        flush();
+    }
+
+    const String& tool() const { return _tool; }
+    bool sawReply() const { return _sawReply; }
+
+private:
+    enum State { SCAN, KEY, AFTER_KEY, BEFORE_VALUE, VALUE, SKIP_STRING };
+    enum Field { FIELD_NONE, FIELD_REPLY, FIELD_TOOL };
+
+    TokenCallback _onReply;
+    State _state = SCAN;
+    Field _field = FIELD_NONE;
+    int _depth = 0;
+    bool _escape = false;
+    uint8_t _unicodeLeft = 0;
+    uint16_t _unicode = 0;
+    char _key[16];
+    uint8_t _keyLen = 0;
+    char _out[128];
+    size_t _outLen = 0;
+    String _tool;
+    bool _sawReply = false;
+
+    void step(char c) {
+        switch (_state) {
+            case SCAN:
+                if (c == '{' || c == '[') _depth++;
+                else if (c == '}' || c == ']') _depth--;
+                else if (c == '"') {
+                    if (_depth == 1) {
+                        _state = KEY;
+                        _keyLen = 0;
+                    } else {
+                        _state = SKIP_STRING;
+                    }
+                }
+                break;
+
+            case KEY:
+                if (_escape) { _escape = false; break; }
+                if (c == '\\') { _escape = true; break; }
+                if (c == '"') {
+                    _key[_keyLen] = '\0';
+                    _state = AFTER_KEY;
+                } else if (_keyLen + 1 < sizeof(_key)) {
+                    _key[_keyLen++] = c;
+                }
+                break;
+
+            case AFTER_KEY:
+                if (c == ':') {
+                    _state = BEFORE_VALUE;
+                    if (strcmp(_key, "reply") == 0) _field = FIELD_REPLY;
+                    else if (strcmp(_key, "tool") == 0) { _field = FIELD_TOOL; _tool = ""; }
+                    else _field = FIELD_NONE;
+                }
+                break;
+
+            case BEFORE_VALUE:
+                if (c == ' ' || c == '\t' || c == '\n' || c == '\r') break;
+                if (c == '"') {
+                    _state = VALUE;
+                    if (_field == FIELD_REPLY) _sawReply = true;
+                } else {
+                    // Non-string value (number, object, null...): rescan it structurally
+                    _state = SCAN;
+                    _field = FIELD_NONE;
+                    step(c);
+                }
+                break;
+
+            case VALUE:
+            case SKIP_STRING:
+                if (_unicodeLeft > 0) {
+                    _unicode = (_unicode << 4) | hexValue(c);
+                    if (--_unicodeLeft == 0) emitCodepoint(_unicode);
+                    break;
+                }
+                if (_escape) {
+                    _escape = false;
+                    switch (c) {
+                        case 'n': emit('\n'); break;
+                        case 't': emit('\t'); break;
+                        case 'r': emit('\r'); break;
+                        case 'b': emit('\b'); break;
+                        case 'f': emit('\f'); break;
+                        case 'u': _unicodeLeft = 4; _unicode = 0; break;
+                        default: emit(c); break; // \" \\ \/
+                    }
+                    break;
+                }
+                if (c == '\\') { _escape = true; break; }
+                if (c == '"') {
+                    _state = SCAN;
+                    _field = FIELD_NONE;
+                    break;
+                }
+                emit(c);
+                break;
+        }
+    }
+
+    void emit(char c) {
+        if (_state != VALUE) return;
+        if (_field == FIELD_TOOL) {
+            _tool += c;
+        } else if (_field == FIELD_REPLY) {
+            if (_outLen + 1 >= sizeof(_out)) flush();
+            _out[_outLen++] = c;
+        }
+    }
+
+    void emitCodepoint(uint16_t cp) {
+        if (cp >= 0xD800 && cp <= 0xDFFF) {
+            emit('?'); // Surrogate halves are not recombined
+        } else if (cp < 0x80) {
+            emit((char)cp);
+        } else if (cp < 0x800) {
+            emit((char)(0xC0 | (cp >> 6)));
+            emit((char)(0x80 | (cp & 0x3F)));
+        } else {
+            emit((char)(0xE0 | (cp >> 12)));
+            emit((char)(0x80 | ((cp >> 6) & 0x3F)));
+            emit((char)(0x80 | (cp & 0x3F)));
+        }
+    }
+
+    void flush() {
+        if (_outLen == 0) return;
+        _out[_outLen] = '\0';
+        if (_onReply) _onReply(_out);
+        _outLen = 0;
+    }
+
+    static uint8_t hexValue(char c) {
+        if (c >= '0' && c <= '9') return c - '0';
+        if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+        if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+        return 0;
+    }
+};
+
+#endif
@@ -1,8 +1,8 @@
 #ifndef TELEGRAM_BOT_H
 #define TELEGRAM_BOT_H
 
-#include <WiFiClientSecure.h>
 #include <ArduinoJson.h>
+#include "http_pool.h"
 
 class TelegramBot {
 public:
@@ -18,16 +18,13 @@ public:
     bool getNewMessage(Message &msg) {
         if (_token == "") return false;
 
-        WiFiClientSecure client;
-        client.setInsecure();
-        HTTPClient http;
-
         String url = "https://api.telegram.org/bot" + String(_token) + "/getUpdates?offset=" + String(_lastUpdateId + 1) + "&limit=1&timeout=0";
         
-        if (http.begin(client, url)) {
-            int httpCode = http.GET();
+        int httpCode;
+        HTTPClient* http = httpPool.perform(url, [](HTTPClient& h) { return h.GET(); }, &httpCode);
+        if (http) {
             if (httpCode == HTTP_CODE_OK) {
-                String payload = http.getString();
+                String payload = http->getString();
                 DynamicJsonDocument doc(4096);
                 deserializeJson(doc, payload);
 
@@ -39,13 +36,13 @@ public:
                     msg.chatId = update["message"]["chat"]["id"].as<String>();
                     msg.text = update["message"]["text"].as<String>();
                     
-                    http.end();
+                    httpPool.release(http);
                     return true;
                 }
             } else {
                // Serial.println("Telegram Poll Failed: " + String(httpCode));
             }
-            http.end();
+            httpPool.release(http);
         }
         return false;
     }
@@ -53,27 +50,24 @@ public:
     void sendMessage(String chatId, String text) {
         if (_token == "") return;
 
-        WiFiClientSecure client;
-        client.setInsecure();
-        HTTPClient http;
-
         String url = "https://api.telegram.org/bot" + String(_token) + "/sendMessage";
-        
-        if (http.begin(client, url)) {
-            http.addHeader("Content-Type", "application/json");
-            
-            DynamicJsonDocument doc(2048);
-            doc["chat_id"] = chatId;
-            doc["text"] = text;
-            String payload;
-            serializeJson(doc, payload); // Handles escaping
 
-            int httpCode = http.POST(payload);
-            if (httpCode != HTTP_CODE_OK) {
-                Serial.println("Telegram Send Failed: " + http.getString());
-            }
-            http.end();
+        DynamicJsonDocument doc(2048);
+        doc["chat_id"] = chatId;
+        doc["text"] = text;
+        String payload;
+        serializeJson(doc, payload); // Handles escaping
+
+        int httpCode;
+        HTTPClient* http = httpPool.perform(url, [&](HTTPClient& h) {
+            h.addHeader("Content-Type", "application/json");
+            return h.POST(payload);
+        }, &httpCode);
+        if (!http) return;
+        if (httpCode != HTTP_CODE_OK) {
+            Serial.println("Telegram Send Failed: " + http->getString());
         }
+        httpPool.release(http);
     }
 
 private:
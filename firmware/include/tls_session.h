@@ -0,0 +1,288 @@
+#ifndef TLS_SESSION_H
+#define TLS_SESSION_H
+
+#include <WiFi.h>
+#include <WiFiClientSecure.h>
+#include <LittleFS.h>
+#include <ArduinoJson.h>
+#include <lwip/sockets.h>
+#include <mbedtls/ssl.h>
+#include <mbedtls/net_sockets.h>
+
+#define TLS_SESSION_SLOTS 4
+#define TLS_SESSION_MAX_BYTES 4096  // Serialized sessions carry the peer cert; skip anything larger
+#define TLS_SESSION_DIR "/tls"
+
+// Remembers the last TLS session (ID + ticket) per host so reconnects can do
+// an abbreviated handshake. Optionally mirrored to LittleFS so the benefit
+// survives reboots. Files hold session secrets; they never leave the device.
+class TlsSessionCache {
+public:
+    TlsSessionCache() { _lock = xSemaphoreCreateMutex(); }
+
+    struct Stats {
+        uint32_t full = 0;     // Full handshakes (no session, or server refused it)
+        uint32_t resumed = 0;  // Abbreviated handshakes
+        uint32_t saved = 0;    // Sessions written to flash
+    };
+
+    void setPersistent(bool persist) { _persist = persist; }
+
+    // Offers the cached session for host on a freshly set-up SSL context.
+    // Returns true if one was offered; its ID is kept for the resume check.
+    bool offer(mbedtls_ssl_context* ssl, const char* host) {
+        Lock lock(_lock); // Handshakes may run on several tasks
+        Entry* e = find(host, true);
+        if (!e || !e->blob) return false;
+
+        mbedtls_ssl_session session;
+        mbedtls_ssl_session_init(&session);
+        bool ok = mbedtls_ssl_session_load(&session, e->blob, e->len) == 0 &&
+                  mbedtls_ssl_set_session(ssl, &session) == 0;
+        if (ok) {
+            e->offeredIdLen = session.id_len;
+            memcpy(e->offeredId, session.id, session.id_len);
+        } else {
+            drop(e); // Stale format (e.g. after a firmware update)
+        }
+        mbedtls_ssl_session_free(&session);
+        return ok;
+    }
+
+    // Called after a successful handshake. Counts it as resumed or full and
+    // stores the (possibly new) session for next time.
+    bool record(mbedtls_ssl_context* ssl, const char* host, bool offered) {
+        Lock lock(_lock);
+        Entry* e = find(host, false);
+        if (!e) e = claim(host);
+
+        mbedtls_ssl_session session;
+        mbedtls_ssl_session_init(&session);
+        if (mbedtls_ssl_get_session(ssl, &session) != 0) {
+            mbedtls_ssl_session_free(&session);
+            _stats.full++;
+            return false;
+        }
+
+        // On resumption the server echoes the session ID we offered
+        bool resumed = offered && e->offeredIdLen > 0 &&
+                       session.id_len == e->offeredIdLen &&
+                       memcmp(session.id, e->offeredId, session.id_len) == 0;
+        e->offeredIdLen = 0;
+
+        if (resumed) {
+            _stats.resumed++;
+        } else {
+            _stats.full++;
+            size_t len = 0;
+            mbedtls_ssl_session_save(&session, nullptr, 0, &len);
+            if (len > 0 && len <= TLS_SESSION_MAX_BYTES) {
+                uint8_t* blob = (uint8_t*)malloc(len);
+                if (blob && mbedtls_ssl_session_save(&session, blob, len, &len) == 0) {
+                    free(e->blob);
+                    e->blob = blob;
+                    e->len = len;
+                    if (_persist) persist(e);
+                } else {
+                    free(blob);
+                }
+            }
+        }
+        mbedtls_ssl_session_free(&session);
+        return resumed;
+    }
+
+    const Stats& stats() const { return _stats; }
+
+    void addStats(JsonObject obj) const {
+        obj["tls_full"] = _stats.full;
+        obj["tls_resumed"] = _stats.resumed;
+        obj["tls_saved"] = _stats.saved;
+    }
+
+private:
+    struct Entry {
+        String host;
+        uint8_t* blob = nullptr;
+        size_t len = 0;
+        bool loaded = false;        // Flash copy already consulted
+        uint8_t offeredId[32];
+        size_t offeredIdLen = 0;
+    };
+
+    struct Lock {
+        SemaphoreHandle_t m;
+        Lock(SemaphoreHandle_t mutex) : m(mutex) { xSemaphoreTake(m, portMAX_DELAY); }
+        ~Lock() { xSemaphoreGive(m); }
+    };
+
+    Entry _entries[TLS_SESSION_SLOTS];
+    Stats _stats;
+    SemaphoreHandle_t _lock;
+    bool _persist = true;
+    uint8_t _next = 0;
+
+    Entry* find(const char* host, bool create) {
+        for (Entry& e : _entries) {
+            if (e.host == host) return &e;
+        }
+        if (!create) return nullptr;
+        Entry* e = claim(host);
+        if (_persist) load(e);
+        return e;
+    }
+
+    Entry* claim(const char* host) {
+        Entry* e = &_entries[_next];
+        _next = (_next + 1) % TLS_SESSION_SLOTS;
+        drop(e);
+        e->host = host;
+        e->loaded = false;
+        return e;
+    }
+
+    void drop(Entry* e) {
+        free(e->blob);
+        e->blob = nullptr;
+        e->len = 0;
+        e->offeredIdLen = 0;
+    }
+
+    String pathFor(const String& host) {
+        return String(TLS_SESSION_DIR) + "/" + host + ".ses";
+    }
+
+    void load(Entry* e) {
+        if (e->loaded) return;
+        e->loaded = true;
+        String path = pathFor(e->host);
+        if (!LittleFS.exists(path)) return;
+        File f = LittleFS.open(path, "r");
+        if (!f) return;
+        size_t len = f.size();
+        if (len > 0 && len <= TLS_SESSION_MAX_BYTES) {
+            uint8_t* blob = (uint8_t*)malloc(len);
+            if (blob && f.read(blob, len) == len) {
+                e->blob = blob;
+                e->len = len;
+            } else {
+                free(blob);
+            }
+        }
+        f.close();
+    }
+
+    void persist(Entry* e) {
+        if (!LittleFS.exists(TLS_SESSION_DIR)) LittleFS.mkdir(TLS_SESSION_DIR);
+        File f = LittleFS.open(pathFor(e->host), "w");
+        if (!f) return;
+        f.write(e->blob, e->len);
+        f.close();
+        _stats.saved++;
+    }
+};
+
+extern TlsSessionCache tlsSessions;
+
+// WiFiClientSecure whose connect() runs the TLS handshake itself so it can
+// offer a cached session first. Everything after the handshake (read, write,
+// stop) is the stock implementation on the same sslclient context.
+// Certificates are not verified, matching setInsecure() elsewhere.
+class ResumableTlsClient : public WiFiClientSecure {
+public:
+    using WiFiClientSecure::connect;
+
+    int connect(const char* host, uint16_t port) override {
+        return connect(host, port, _timeout);
+    }
+
+    int connect(const char* host, uint16_t port, int32_t timeout) {
+        IPAddress ip;
+        if (!WiFi.hostByName(host, ip)) return 0;
+        return startTls(ip, port, host, timeout) ? 1 : 0;
+    }
+
+private:
+    bool startTls(IPAddress ip, uint16_t port, const char* host, int32_t timeout) {
+        stop();
+        if (timeout <= 0) timeout = 30000;
+
+        sslclient_context* ctx = sslclient;
+        ctx->socket = lwip_socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (ctx->socket < 0) return false;
+
+        // Non-blocking connect bounded by the timeout, same as the stock client
+        fcntl(ctx->socket, F_SETFL, fcntl(ctx->socket, F_GETFL, 0) | O_NONBLOCK);
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = ip;
+        addr.sin_port = htons(port);
+
+        int res = lwip_connect(ctx->socket, (struct sockaddr*)&addr, sizeof(addr));
+        if (res < 0 && errno != EINPROGRESS) return fail();
+
+        fd_set fdset;
+        FD_ZERO(&fdset);
+        FD_SET(ctx->socket, &fdset);
+        struct timeval tv;
+        tv.tv_sec = timeout / 1000;
+        tv.tv_usec = (timeout % 1000) * 1000;
+        if (select(ctx->socket + 1, nullptr, &fdset, nullptr, &tv) <= 0) return fail();
+
+        int sockErr = 0;
+        socklen_t errLen = sizeof(sockErr);
+        getsockopt(ctx->socket, SOL_SOCKET, SO_ERROR, &sockErr, &errLen);
+        if (sockErr != 0) return fail();
+
+        int enable = 1;
+        lwip_setsockopt(ctx->socket, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+        lwip_setsockopt(ctx->socket, SOL_SOCKET, SO_KEEPALIVE, &enable, sizeof(enable));
+
+        mbedtls_ssl_init(&ctx->ssl_ctx);
+        mbedtls_ssl_config_init(&ctx->ssl_conf);
+        mbedtls_ctr_drbg_init(&ctx->drbg_ctx);
+        mbedtls_entropy_init(&ctx->entropy_ctx);
+
+        const char* pers = "microclaw";
+        if (mbedtls_ctr_drbg_seed(&ctx->drbg_ctx, mbedtls_entropy_func, &ctx->entropy_ctx,
+                                  (const unsigned char*)pers, strlen(pers)) != 0) return fail();
+        if (mbedtls_ssl_config_defaults(&ctx->ssl_conf, MBEDTLS_SSL_IS_CLIENT,
+                                        MBEDTLS_SSL_TRANSPORT_STREAM, MBEDTLS_SSL_PRESET_DEFAULT) != 0) return fail();
+        mbedtls_ssl_conf_authmode(&ctx->ssl_conf, MBEDTLS_SSL_VERIFY_NONE);
+        mbedtls_ssl_conf_rng(&ctx->ssl_conf, mbedtls_ctr_drbg_random, &ctx->drbg_ctx);
+#ifdef MBEDTLS_SSL_SESSION_TICKETS
+        mbedtls_ssl_conf_session_tickets(&ctx->ssl_conf, MBEDTLS_SSL_SESSION_TICKETS_ENABLED);
+#endif
+        if (mbedtls_ssl_setup(&ctx->ssl_ctx, &ctx->ssl_conf) != 0) return fail();
+        if (mbedtls_ssl_set_hostname(&ctx->ssl_ctx, host) != 0) return fail();
+        mbedtls_ssl_set_bio(&ctx->ssl_ctx, &ctx->socket, mbedtls_net_send, mbedtls_net_recv, nullptr);
+
+        bool offered = tlsSessions.offer(&ctx->ssl_ctx, host);
+
+        unsigned long handshakeTimeout = ctx->handshake_timeout ? ctx->handshake_timeout : 30000;
+        unsigned long start = millis();
+        int ret;
+        while ((ret = mbedtls_ssl_handshake(&ctx->ssl_ctx)) != 0) {
+            if (ret != MBEDTLS_ERR_SSL_WANT_READ && ret != MBEDTLS_ERR_SSL_WANT_WRITE) {
+                Serial.printf("TLS: handshake with %s failed (-0x%04x)\n", host, -ret);
+                return fail();
+            }
+            if (millis() - start > handshakeTimeout) return fail();
+            vTaskDelay(2);
+        }
+
+        bool resumed = tlsSessions.record(&ctx->ssl_ctx, host, offered);
+        Serial.printf("TLS: %s handshake with %s in %lums\n", resumed ? "resumed" : "full", host, millis() - start);
+
+        _connected = true;
+        return true;
+    }
+
+    bool fail() {
+        stop(); // Closes the socket and frees the mbedTLS contexts
+        return false;
+    }
+};
+
+#endif
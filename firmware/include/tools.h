@@ -4,103 +4,35 @@
 #include "common.h"
 #include "wifi_tools.h"
 #include "ble_tools.h"
+#include "memory_store.h"
+#include "memory_index.h"
+#include "script_manager.h"
+#include "script_library.h"
+#include "rule_engine.h"
+#include "pulse_tools.h"
+#include "adc_sampler.h"
+
+#define TOOLS_MAX_CALLS 6         // Tool calls honoured from one model turn
+#define TOOLS_MAX_PARALLEL 4
+#define TOOL_TASK_STACK 8192
 
 class Tools {
 public:
     Tools() {}
 
-    // Payload for the task
-    struct ScriptTaskParams {
-        String scriptJson;
-    };
-
-    // FreeRTOS Task to run the script
-    static void scriptTask(void* parameter) {
-        ScriptTaskParams* params = (ScriptTaskParams*)parameter;
-        DynamicJsonDocument doc(4096);
-        deserializeJson(doc, params->scriptJson);
-        JsonArray script = doc.as<JsonArray>();
-
-        for (JsonVariant v : script) {
-            JsonObject cmd = v.as<JsonObject>();
-            String type = cmd["cmd"].as<String>();
-            
-            if (type == "gpio") {
-                int pin = cmd["pin"];
-                int state = cmd["state"];
-                pinMode(pin, OUTPUT);
-                digitalWrite(pin, state ? HIGH : LOW);
-            }
-            else if (type == "delay") {
-                int ms = cmd["ms"];
-                delay(ms); // Task delay, doesn't block system
-            }
-            else if (type == "loop") {
-                int count = cmd["count"];
-                JsonArray steps = cmd["steps"].as<JsonArray>();
-                
-                for (int i = 0; i < count; i++) {
-                    executeScriptInternal(steps);
-                }
-            }
+    // Validates and compiles the script up front (errors are reported to the
+    // caller), then hands it to the script manager to run on its own task
+    String runScript(JsonArray script) {
+        ScriptProgram* program = new ScriptProgram();
+        String error;
+        if (!program->compile(script, error)) {
+            delete program;
+            return error;
         }
-        
-        // Cleanup
-        delete params;
-        vTaskDelete(NULL);
-    }
 
-    // Helper for internal blocking execution (recursion support)
-    static void executeScriptInternal(JsonArray script) {
-         for (JsonVariant v : script) {
-            JsonObject cmd = v.as<JsonObject>();
-            String type = cmd["cmd"].as<String>();
-            
-            if (type == "gpio") {
-                int pin = cmd["pin"];
-                int state = cmd["state"];
-                pinMode(pin, OUTPUT);
-                digitalWrite(pin, state ? HIGH : LOW);
-            }
-            else if (type == "delay") {
-                int ms = cmd["ms"];
-                delay(ms);
-            }
-            // Loop support max 1 level of recursion to avoid stack overflow in task
-            // or we could allow it but need to be careful.
-             else if (type == "loop") {
-                int count = cmd["count"];
-                JsonArray steps = cmd["steps"].as<JsonArray>();
-                for(int i=0; i<count; i++) {
-                    executeScriptInternal(steps);
-                }
-             }
-         }
-    }
-
-    // New runScript launches the task
-    String runScript(JsonArray script) {
-        if (script.isNull()) return "Invalid script";
-        
-        // Serialize script to string to pass to task
-        String scriptJson;
-        serializeJson(script, scriptJson);
-        
-        ScriptTaskParams* params = new ScriptTaskParams();
-        params->scriptJson = scriptJson;
-
-        // Launch Task on Core 1 (Application Core) or Core 0. Arduino runs on 1 usually.
-        // Stack size 8192 should be plenty for JSON parsing.
-        xTaskCreate(
-            scriptTask,     // Function
-            "ScriptTask",   // Name
-            8192,           // Stack size
-            params,         // Parameters
-            1,              // Priority
-            NULL            // Handle
-        );
-        
-        return "Script started in background";
+        uint32_t id = scripts.start(program, error);
+        if (!id) return error;
+        return "Script " + String(id) + " started in background";
     }
 
     // Execute a tool call based on name and arguments (JSON object)
@@ -111,19 +43,56 @@ public:
         if (toolName == "run_script") {
             return runScript(args["script"].as<JsonArray>());
         }
+        else if (toolName == "script_list") {
+            return "{\"running\":" + scripts.listJson() + ",\"saved\":" + scriptLibrary.listJson() + "}";
+        }
+        else if (toolName == "script_save") {
+            const char* name = args["name"];
+            if (!name) return "Error: Name required";
+            return scriptLibrary.save(name, args["script"].as<JsonArray>(), args["autostart"] | false);
+        }
+        else if (toolName == "script_run") {
+            const char* name = args["name"];
+            if (!name) return "Error: Name required";
+            return scriptLibrary.run(name);
+        }
+        else if (toolName == "script_stop") {
+            // Stopping everything must be asked for: a missing id is an error
+            if (args["all"] | false) {
+                int stopped = scripts.stop(0);
+                if (stopped == 0) return "No scripts running";
+                return "Stopped " + String(stopped) + " scripts";
+            }
+            uint32_t id = args["id"] | 0;
+            if (id == 0) return "Error: id required (or all: true)";
+            if (scripts.stop(id) == 0) return "Error: No running script " + String(id);
+            return "Script " + String(id) + " stopped";
+        }
+        else if (toolName == "rule_add") {
+            const char* tool = args["tool"] | "";
+            if (*tool && !isRuleAction(tool)) return String("Error: Rules cannot call ") + tool;
+            return rules.add(args);
+        }
+        else if (toolName == "rule_list") {
+            return rules.listJson();
+        }
+        else if (toolName == "rule_remove") {
+            uint32_t id = args["id"] | 0;
+            if (!rules.remove(id)) return "Error: No rule " + String(id);
+            return "Rule " + String(id) + " removed";
+        }
         else if (toolName == "memory_write") {
             const char* content = args["content"];
-            if (content) {
-                fsManager.appendFile("/MEMORY.md", content);
-                fsManager.appendFile("/MEMORY.md", "\n");
+            size_t offset = memoryStore.fileSize();
+            if (memoryStore.append(content)) {
+                memoryIndex.add(offset, content);
                 return "Memory updated";
             }
             return "No content provided";
         }
         else if (toolName == "memory_read") {
-            String mem = fsManager.readFile("/MEMORY.md");
-            if (mem == "") return "Memory is empty";
-            return mem;
+            if (memoryStore.size() == 0) return "Memory is empty";
+            return String(memoryStore.c_str());
         }
         else if (toolName == "get_system_stats") {
             return SystemTools::getSystemInfo();
@@ -138,6 +107,17 @@ public:
                 return GpioTools::getPin(pin);
             }
         }
+        else if (toolName == "gpio_mask") {
+            return GpioTools::setMask(GpioTools::pinMask(args["set"]), GpioTools::pinMask(args["clear"]));
+        }
+        else if (toolName == "pulse_count") {
+            return PulseTools::measure(args["pin"] | -1, args["gate_ms"] | (long)PULSE_GATE_DEFAULT_MS,
+                                       args["filter_ns"] | 0L, args["edge"] | "rising");
+        }
+        else if (toolName == "adc_sample") {
+            return AdcSampler::sample(args["pin"] | -1, args["samples"] | (long)ADC_SAMPLES_DEFAULT,
+                                      args["rate_hz"] | (long)ADC_RATE_DEFAULT, args["fft"] | false);
+        }
         else if (toolName == "wifi_scan") {
             return WifiTools::scan();
         }
@@ -155,6 +135,182 @@ public:
 
         return "Unknown tool";
     }
+
+    // One call of a multi-tool turn
+    struct ToolCall {
+        String name;
+        JsonObject args;
+        String result;
+        bool ready = false;       // Result already set (malformed call); not executed
+    };
+
+    // Runs every call of one model turn. Hardware-local tools (scans, stats,
+    // GPIO reads and writes) each get their own task, spread across both
+    // cores, so e.g. a BLE and a WiFi scan overlap; tools that touch shared
+    // state (memory, the BLE connection) run afterwards, one by one, on the
+    // caller. At most one task is started per tool name, as two scans of the
+    // same radio must not run at once: a repeated identical call takes the
+    // first one's result, any other repeat runs on the caller afterwards.
+    void executeAll(ToolCall* calls, int count) {
+        struct TaskCtx {
+            Tools* tools;
+            ToolCall* call;
+            SemaphoreHandle_t done;
+        };
+        if (count > TOOLS_MAX_CALLS) count = TOOLS_MAX_CALLS;
+        int sameAs[TOOLS_MAX_CALLS];   // Index of an earlier identical call, or -1
+        bool ran[TOOLS_MAX_CALLS] = {};
+        String argText[TOOLS_MAX_CALLS];
+        for (int i = 0; i < count; i++) {
+            serializeJson(calls[i].args, argText[i]);
+            sameAs[i] = -1;
+            for (int j = 0; j < i && sameAs[i] < 0; j++) {
+                if (sameAs[j] < 0 && !calls[j].ready && calls[j].name == calls[i].name && argText[j] == argText[i]) sameAs[i] = j;
+            }
+        }
+
+        TaskCtx ctx[TOOLS_MAX_PARALLEL];
+        SemaphoreHandle_t done = xSemaphoreCreateCounting(TOOLS_MAX_PARALLEL, 0);
+        int started = 0;
+
+        for (int i = 0; i < count; i++) {
+            if (!done || calls[i].ready || sameAs[i] >= 0 || !isParallelSafe(calls[i].name) || started == TOOLS_MAX_PARALLEL) continue;
+            bool nameTaken = false;
+            for (int t = 0; t < started; t++) {
+                if (ctx[t].call->name == calls[i].name) nameTaken = true;
+            }
+            if (nameTaken) continue;
+            ctx[started] = {this, &calls[i], done};
+            BaseType_t ok = xTaskCreatePinnedToCore(
+                [](void* arg) {
+                    TaskCtx* c = (TaskCtx*)arg;
+                    c->call->result = c->tools->execute(c->call->name, c->call->args);
+                    xSemaphoreGive(c->done);
+                    vTaskDelete(NULL);
+                },
+                "ToolTask", TOOL_TASK_STACK, &ctx[started], 1, NULL, started % 2);
+            if (ok == pdPASS) {
+                ran[i] = true;
+                started++;
+            }
+        }
+        for (int t = 0; t < started; t++) xSemaphoreTake(done, portMAX_DELAY);
+        if (done) vSemaphoreDelete(done);
+
+        // Whatever did not get a task runs here, in order
+        for (int i = 0; i < count; i++) {
+            if (ran[i] || calls[i].ready) continue;
+            if (sameAs[i] >= 0) calls[i].result = calls[sameAs[i]].result;
+            else calls[i].result = execute(calls[i].name, calls[i].args);
+        }
+    }
+
+    // Local result formatters: tools whose output can be turned into the final
+    // reply on-device, so the follow-up LLM call is skipped. Return false to
+    // leave a result (errors, open-ended data such as scans) to the model.
+    typedef bool (*ResultFormatter)(JsonObject args, const String& result, String& reply);
+
+    static bool formatResult(const String& toolName, JsonObject args, const String& result, String& reply) {
+        struct Entry { const char* tool; ResultFormatter format; };
+        static const Entry formatters[] = {
+            {"get_system_stats", formatSystemStats},
+            {"gpio_control", formatGpio},
+            {"gpio_mask", formatDone},
+            {"pulse_count", formatPulseCount},
+            {"adc_sample", formatAdcSample},
+            {"run_script", formatScriptStarted},
+            {"script_run", formatScriptStarted},
+            {"script_stop", formatDone},
+            {"script_save", formatDone},
+            {"rule_add", formatDone},
+            {"rule_remove", formatDone},
+            {"memory_write", formatMemoryWrite},
+        };
+        if (result.startsWith("Error")) return false;
+        for (const Entry& f : formatters) {
+            if (toolName == f.tool) return f.format(args, result, reply);
+        }
+        return false;
+    }
+
+    // Tools a rule may fire from the rule task, alongside an agent turn:
+    // local hardware only, never the shared radio (scans, BLE)
+    static bool isRuleAction(const String& toolName) {
+        return toolName == "gpio_control" || toolName == "gpio_mask" || toolName == "pulse_count" ||
+               toolName == "adc_sample" || toolName == "script_run" || toolName == "script_stop";
+    }
+
+private:
+    // Stats, scans and local hardware (gpio_control and gpio_mask write pins,
+    // but only through per-pin registers); everything else is serialized
+    static bool isParallelSafe(const String& toolName) {
+        return toolName == "get_system_stats" || toolName == "wifi_scan" ||
+               toolName == "ble_scan" || toolName == "gpio_control" || toolName == "gpio_mask" ||
+               toolName == "pulse_count" || toolName == "adc_sample";
+    }
+
+    static bool formatSystemStats(JsonObject, const String& result, String& reply) {
+        StaticJsonDocument<512> doc;
+        if (deserializeJson(doc, result)) return false;
+        reply = "Free heap: " + String(doc["heap_free"].as<uint32_t>()) + " bytes (largest block " +
+                String(doc["heap_max_alloc"].as<uint32_t>()) + ", lowest ever " +
+                String(doc["heap_min_free"].as<uint32_t>()) + "). CPU at " +
+                String(doc["cpu_freq_mhz"].as<int>()) + " MHz, up for " +
+                String(doc["uptime_seconds"].as<uint32_t>()) + " s, SDK " + doc["sdk_version"].as<String>() + ".";
+        return true;
+    }
+
+    static bool formatGpio(JsonObject args, const String& result, String& reply) {
+        if (String((const char*)(args["mode"] | "")) == "output") {
+            reply = "Done. " + result + ".";
+        } else {
+            reply = "Pin " + String(args["pin"].as<int>()) + " reads " + (result == "1" ? "HIGH" : "LOW") + ".";
+        }
+        return true;
+    }
+
+    static bool formatPulseCount(JsonObject, const String& result, String& reply) {
+        StaticJsonDocument<192> doc;
+        if (deserializeJson(doc, result)) return false;
+        reply = "Pin " + String(doc["pin"].as<int>()) + " counted " + String(doc["count"].as<uint32_t>()) +
+                " pulses in " + String(doc["gate_ms"].as<uint32_t>()) + " ms, " + String(doc["hz"].as<double>(), 1) + " Hz.";
+        return true;
+    }
+
+    static bool formatAdcSample(JsonObject, const String& result, String& reply) {
+        StaticJsonDocument<384> doc;
+        if (deserializeJson(doc, result)) return false;
+        reply = "Pin " + String(doc["pin"].as<int>()) + ", " + String(doc["samples"].as<long>()) + " samples at " +
+                String(doc["rate_hz"].as<uint32_t>()) + " Hz: mean " + String(doc["mean_mv"].as<float>(), 1) +
+                " mV (min " + String(doc["min_mv"].as<uint32_t>()) + ", max " + String(doc["max_mv"].as<uint32_t>()) +
+                "), RMS " + String(doc["rms_mv"].as<float>(), 1) + " mV, AC RMS " + String(doc["ac_rms_mv"].as<float>(), 1) + " mV";
+        JsonObject fft = doc["fft"];
+        if (!fft.isNull()) {
+            reply += "; strongest tone " + String(fft["peak_hz"].as<float>(), 1) + " Hz at " +
+                     String(fft["peak_mv"].as<float>(), 1) + " mV";
+        }
+        reply += ".";
+        return true;
+    }
+
+    // Results that are already a sentence
+    static bool formatDone(JsonObject, const String& result, String& reply) {
+        reply = "Done. " + result + ".";
+        return true;
+    }
+
+    static bool formatScriptStarted(JsonObject, const String& result, String& reply) {
+        if (!result.startsWith("Script ") || !result.endsWith(" started in background")) return false;
+        reply = "I have started the script (id " + result.substring(7, result.indexOf(' ', 7)) +
+                "); you should see it running now.";
+        return true;
+    }
+
+    static bool formatMemoryWrite(JsonObject, const String& result, String& reply) {
+        if (result != "Memory updated") return false;
+        reply = "Got it, I'll remember that.";
+        return true;
+    }
 };
 
 #endif
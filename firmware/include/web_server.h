@@ -3,49 +3,87 @@
 
 #include <WebServer.h>
 #include "common.h"
+#include "agent_worker.h"
+#include "script_manager.h"
+#include "script_library.h"
 
 class WebInterface {
 public:
     WebInterface(int port = 80) : server(port) {}
 
-    // Callback type for processing messages
-    typedef std::function<String(String)> MessageHandler;
-
-    void begin(MessageHandler handler) {
-        _handler = handler;
-
+    void begin() {
         // Serve HTML
         server.on("/", HTTP_GET, [this]() {
             server.send(200, "text/html", getHtml());
         });
 
-        // Handle Chat API
+        // Handle Chat API: queues the request for the agent worker and answers
+        // at once with a job id; the result is fetched from /api/job
         server.on("/api/chat", HTTP_POST, [this]() {
             if (!server.hasArg("plain")) {
                 server.send(400, "application/json", "{\"error\":\"No body\"}");
                 return;
             }
 
-            if (server.hasArg("plain") && _handler) {
-                String reply = _handler(server.arg("plain"));
-                
-                DynamicJsonDocument responseDoc(4096);
-                
-                // Try to parse reply as JSON if it's a structural thought/tool block
-                // (main.cpp handles parsing AI output into a final reply string currently)
-                // However, the user wants the UI to display which tool was called.
-                // We should ideally pass the structured data from main.cpp back here.
-                
-                // For now, let's just send the raw reply string if main.cpp already 
-                // appended the [Tool: ...] info, OR better yet, let main.cpp return JSON.
-                
-                // [DEBT] main.cpp handleAgentRequest currently returns a String. 
-                // Let's modify handleAgentRequest to return a JSON string.
-                
-                server.send(200, "application/json", reply);
-            } else {
-                server.send(400, "application/json", "{\"error\":\"Empty message\"}");
+            uint32_t id = agentWorker.submit(AgentJob::WEB, server.arg("plain"));
+            if (id == 0) {
+                server.send(503, "application/json", "{\"error\":\"Agent busy, try again shortly\"}");
+                return;
             }
+            server.send(202, "application/json", "{\"job\":" + String(id) + "}");
+        });
+
+        // Job status: reply text streamed since byte offset `since`, plus the
+        // final JSON (same shape as before: reply/thought/tool/tool_result) once done
+        server.on("/api/job", HTTP_GET, [this]() {
+            uint32_t id = strtoul(server.arg("id").c_str(), nullptr, 10);
+            size_t since = server.arg("since").toInt();
+            String out;
+            if (!agentWorker.poll(id, since, out)) {
+                server.send(404, "application/json", "{\"error\":\"Unknown job\"}");
+                return;
+            }
+            server.sendHeader("Cache-Control", "no-cache");
+            server.send(200, "application/json", out);
+        });
+
+        // Saved scripts: list, save, run, stop and delete without the agent
+        server.on("/api/scripts", HTTP_GET, [this]() {
+            server.sendHeader("Cache-Control", "no-cache");
+            server.send(200, "application/json",
+                        "{\"running\":" + scripts.listJson() + ",\"saved\":" + scriptLibrary.listJson() + "}");
+        });
+
+        // Body: {"name": "...", "script": [...], "autostart": false}
+        server.on("/api/scripts", HTTP_POST, [this]() {
+            DynamicJsonDocument doc(server.arg("plain").length() * 2 + 256);
+            if (deserializeJson(doc, server.arg("plain"))) {
+                sendResult("Error: Body must be {\"name\", \"script\": [...]}");
+                return;
+            }
+            sendResult(scriptLibrary.save(doc["name"] | "", doc["script"].as<JsonArray>(), doc["autostart"] | false));
+        });
+
+        server.on("/api/scripts/run", HTTP_POST, [this]() {
+            sendResult(scriptLibrary.run(server.arg("name")));
+        });
+
+        // ?id=N stops one script; stopping everything takes an explicit ?all=1
+        server.on("/api/scripts/stop", HTTP_POST, [this]() {
+            if (server.arg("all") == "1") {
+                sendResult("Stopped " + String(scripts.stop(0)) + " script(s)");
+                return;
+            }
+            uint32_t id = strtoul(server.arg("id").c_str(), nullptr, 10);
+            if (id == 0) {
+                sendResult("Error: id required (or all=1)");
+                return;
+            }
+            sendResult(scripts.stop(id) ? "Stopped script " + String(id) : "Error: No running script " + String(id));
+        });
+
+        server.on("/api/scripts/delete", HTTP_POST, [this]() {
+            sendResult(scriptLibrary.remove(server.arg("name")) ? "Deleted" : "Error: No such script");
         });
 
         server.begin();
@@ -58,7 +96,15 @@ public:
 
 private:
     WebServer server;
-    MessageHandler _handler;
+
+    // {"result": "..."}; 400 for "Error..." results
+    void sendResult(const String& result) {
+        StaticJsonDocument<64> doc;
+        doc["result"] = result.c_str();
+        String out;
+        serializeJson(doc, out);
+        server.send(result.startsWith("Error") ? 400 : 200, "application/json", out);
+    }
 
     String getHtml() {
         return R"rawliteral(
@@ -251,10 +297,12 @@ private:
                     headers: {'Content-Type': 'application/json'},
                     body: JSON.stringify({
                         text: text,
-                        history: chatHistory.slice(-6)
+                        history: chatHistory.slice(-20) // Device trims this to its token budget
                     })
                 });
-                const data = await res.json();
+                const queued = await res.json();
+                if (!res.ok) throw (queued.error || res.status);
+                const data = await waitForJob(queued.job);
                 addMsg(data.reply || "No reply", 'agent', data.thought, data.tool, data.tool_result);
                 saveToHistory(data.reply || "No reply", 'agent', data.thought, data.tool, data.tool_result);
             } catch (e) {
@@ -264,6 +312,44 @@ private:
             input.focus();
         }
 
+        // Polls a queued job, showing reply text in a live bubble as it streams in.
+        // Resolves with the final result JSON.
+        async function waitForJob(id) {
+            const chat = document.getElementById('chat-container');
+            const live = document.createElement('div');
+            live.className = 'message agent';
+            chat.appendChild(live);
+
+            let partial = '', offset = 0, resets = 0;
+            try {
+                while (true) {
+                    const res = await fetch('/api/job?id=' + id + '&since=' + offset);
+                    if (!res.ok) throw "job " + id + " lost";
+                    const job = await res.json();
+                    if ((job.resets || 0) !== resets && job.status !== 'done') {
+                        // Another provider's answer replaced the streamed text: start over
+                        resets = job.resets;
+                        partial = '';
+                        offset = 0;
+                        live.textContent = '';
+                        continue;
+                    }
+                    if (job.tokens) {
+                        partial += job.tokens;
+                        live.textContent = partial;
+                        chat.scrollTop = chat.scrollHeight;
+                    } else if (job.status === 'queued' && !partial) {
+                        live.textContent = job.queued > 0 ? 'Waiting (' + job.queued + ' ahead)...' : 'Thinking...';
+                    }
+                    offset = job.offset;
+                    if (job.status === 'done') return job.result || { reply: partial };
+                    await new Promise(r => setTimeout(r, 250));
+                }
+            } finally {
+                live.remove();
+            }
+        }
+
         function clearHistory() {
             if(confirm("Clear chat history?")) {
                 localStorage.removeItem('microclaw_history');
@@ -1,6 +1,19 @@
 #include "common.h"
 #include "secrets.h"
 #include "config_manager.h"
+#include "http_pool.h"
+#include "prompt_builder.h"
+#include "prompts.h"
+#include "agent_response.h"
+#include "memory_store.h"
+#include "memory_index.h"
+#include "history_manager.h"
+#include "agent_worker.h"
+#include "intent_matcher.h"
+#include "provider_router.h"
+#include "script_manager.h"
+#include "script_library.h"
+#include "rule_engine.h"
 #include "wifi_manager.h"
 #include "gemini_client.h"
 #include "groq_client.h" // Added Groq
@@ -18,6 +31,16 @@
 // Global Objects
 FileSystem fsManager;
 ConfigManager config;
+HttpPool httpPool;
+TlsSessionCache tlsSessions;
+MemoryStore memoryStore;
+MemoryIndex memoryIndex;
+AgentWorker agentWorker;
+IntentMatcher intents;
+ProviderRouter router;
+ScriptManager scripts;
+ScriptLibrary scriptLibrary;
+RuleEngine rules;
 CLI cli;
 
 // Defer initialization
@@ -28,122 +51,189 @@ TelegramBot* bot = nullptr;
 Tools* tools = nullptr;
 WebInterface* webServer = nullptr;
 
+// Prompt arena: reserved once at boot so prompt assembly never touches the heap.
+// A follow-up call reuses it; the previous prompt has been sent by then (a
+// hedged attempt still in flight works on its own copy).
+// Tool instructions are not in the arena: each client appends its own.
+#define WEB_REQUEST_DOC_SIZE 4096  // Node tree only; string data is parsed in place
+#define PROMPT_TAIL_RESERVE 128
+static char promptArena[PROMPT_ARENA_SIZE];
+PromptBuilder prompt(promptArena, sizeof(promptArena));
+
 // Unified Agent Logic
-String handleAgentRequest(String userText, JsonArray history = JsonArray(), int depth = 0) {
-    if (depth > 5) return "{\"reply\":\"Too much recursion!\"}";
+// onToken (optional) receives reply text while it is still streaming in.
+// forceLlm skips the on-device shortcuts (intents, local result formatting).
+// role selects the model for follow-up turns (the first turn always routes).
+AgentResponse handleAgentRequest(String userText, JsonArray history = JsonArray(), int depth = 0,
+                          TokenCallback onToken = nullptr, bool forceLlm = false,
+                          ModelRole role = ROLE_ROUTE) {
+    if (depth > 5) {
+        AgentResponse out;
+        out.reply = "Too much recursion!";
+        return out;
+    }
     
     Serial.print("User (D");
     Serial.print(depth);
     Serial.print("): ");
     Serial.println(userText);
 
-    // Construct Context from Memory
-    String memory = fsManager.readFile("/MEMORY.md");
-    String contextPrompt = "You are MicroClaw, a physical AI assistant running on an ESP32, created by Abhimanyu Singh. ";
-    contextPrompt += "You can interact with hardware via GPIOs, scan WiFi, and manage system stats. ";
-    if (memory.length() > 0) {
-        contextPrompt += "Your memory (long-term): " + memory + ". ";
+    // Common commands are answered on-device without an LLM round trip
+    AgentResponse local;
+    if (depth == 0 && !forceLlm && config.local_intents && tools && intents.handle(userText, *tools, local)) {
+        return local;
     }
-    
-    if (!history.isNull() && history.size() > 0) {
-        contextPrompt += "Recent conversation history (short-term): ";
-        for (JsonVariant m : history) {
-            String s = m["sender"].as<String>();
-            String t = m["text"].as<String>();
-            String tool_res = m["tool_result"].as<String>();
-            
-            contextPrompt += (s == "user" ? "User: " : "AI: ") + t;
-            if (tool_res.length() > 0 && tool_res != "null") {
-                contextPrompt += " [Tool Result: " + tool_res + "]";
-            }
-            contextPrompt += " | ";
-        }
+
+    // Construct Context from Memory, escaped straight into the prompt arena.
+    // Memory and history may be cut short; the message and instructions always fit.
+    prompt.reset();
+    prompt.setReserve(PROMPT_TAIL_RESERVE + userText.length() * 2);
+
+    prompt.raw(PROMPT_PREAMBLE, FLASH_LEN(PROMPT_PREAMBLE));
+    if (memoryIndex.entryCount() > 0) {
+        // Only the entries relevant to this message, so prompt size stays flat as memory grows
+        prompt.text("Your memory (long-term, most relevant entries):\n");
+        memoryIndex.appendRelevant(prompt, userText.c_str(), config.memory_top_k, config.memory_budget);
     }
     
+    // History within the primary provider's token budget; older turns are summarised
+    ProviderRouter::Provider primary = config.ai_provider == "groq" ? ProviderRouter::GROQ : ProviderRouter::GEMINI;
+    HistoryManager::append(prompt, history, config.history_turns,
+                           primary == ProviderRouter::GROQ ? config.history_budget_groq : config.history_budget_gemini);
+
+    prompt.setReserve(0);
     if (depth > 0) {
-        contextPrompt += "SYSTEM: The tool you called returned: " + userText + ". ";
-        contextPrompt += "Based on this hardware data, provide your final friendly reply to the user. Set tool to 'none'.";
+        prompt.text("SYSTEM: The tool you called returned: ").text(userText).text(". ");
     } else {
-        contextPrompt += "Current User message: " + userText + ". ";
+        prompt.text("Current User message: ").text(userText).text(". ");
     }
 
-    contextPrompt += "Respond with a JSON object: {\"thought\": \"...\", \"tool\": \"tool_name\", \"args\": { ... }, \"reply\": \"...\"}. ";
-    contextPrompt += "Valid tools: 'get_system_stats' {}, 'wifi_scan' {}, 'ble_scan' {}, 'ble_connect' {address: '...'}, 'ble_disconnect' {}, 'memory_write' {content: '...'}, 'memory_read' {}. ";
-    contextPrompt += "'run_script' { script: [ {cmd: \"gpio\", pin: 2, state: 1}, {cmd: \"delay\", ms: 1000}, {cmd: \"loop\", count: 5, steps: [...]} ] }. ";
-    contextPrompt += "Use 'run_script' for ALL hardware control (blinking, patterns, resizing). ";
-    contextPrompt += "IMPORTANT: 'run_script' is NON-BLOCKING. The script runs in the background. ";
-    contextPrompt += "Your reply should be: 'I have started the script...' instead of 'I executed...'. The user will see the action happen immediately after your reply.";
-
-    // Call AI Provider
-    String response;
-    if (config.ai_provider == "groq" && groq) {
-        Serial.println("Using Groq...");
-        response = groq->generateContent(contextPrompt);
-    } else {
-        Serial.println("Using Gemini...");
-        response = gemini->generateContent(contextPrompt);
+    if (prompt.truncated()) {
+        Serial.println("Prompt truncated to fit the arena");
     }
 
-    Serial.print("AI Raw: ");
-    Serial.println(response);
+    // Call AI Provider (primary first; the router fails over or hedges)
+    AgentResponse response = router.generate(prompt, primary, depth > 0 ? role : ROLE_ROUTE, onToken);
 
-    // Parse Response
-    DynamicJsonDocument doc(4096);
-    DeserializationError error = deserializeJson(doc, response);
+    // Check for API Error
+    if (response.failed()) {
+        Serial.println("AI Error: " + response.error);
+        AgentResponse out;
+        out.reply = "I'm having trouble thinking right now. (" + response.error + ")";
+        return out;
+    }
+
+    Serial.print("AI Reply: ");
+    Serial.println(response.reply);
 
-    if (!error) {
-        // Check for API Error
-        if (doc.containsKey("error")) {
-            String errorMsg = doc["error"].as<String>();
-            Serial.println("AI Error: " + errorMsg);
-            return "{\"reply\":\"I'm having trouble thinking right now. (" + errorMsg + ")\"}";
+    // Every tool call of this turn, args still views into the response
+    Tools::ToolCall calls[TOOLS_MAX_CALLS];
+    int callCount = 0;
+    for (JsonObject c : response.calls()) {
+        const char* name = c["tool"];
+        if (!name || strcmp(name, "none") == 0 || callCount == TOOLS_MAX_CALLS) continue;
+        calls[callCount].name = name;
+        calls[callCount].args = c["args"];
+        const char* error = c["error"];
+        if (error) {
+            // The provider sent arguments that did not parse; report, don't run
+            calls[callCount].result = error;
+            calls[callCount].ready = true;
         }
+        callCount++;
+    }
 
-        const char* reply = doc["reply"];
-        const char* thought = doc["thought"];
-        const char* tool = doc["tool"];
-        
-        String toolResult = "";
-        if (tool && String(tool) != "none" && depth == 0) {
-            toolResult = tools->execute(String(tool), doc["args"]);
-            Serial.println("Tool Result: " + toolResult);
-            
-            // SECOND CALL (Follow-up)
-            String secondResponse = handleAgentRequest(toolResult, history, depth + 1);
-            
-            // Extract the final reply from the second call
-            DynamicJsonDocument secondDoc(4096);
-            DeserializationError err = deserializeJson(secondDoc, secondResponse);
-            
-            const char* finalTxt = "I executed the tool but had trouble summarizing the result.";
-            if (!err && secondDoc.containsKey("reply")) {
-                finalTxt = secondDoc["reply"];
+    if (callCount > 0 && depth == 0) {
+        tools->executeAll(calls, callCount);
+
+        // One call keeps its raw result; several are reported together in one follow-up
+        String toolNames;
+        String toolResult;
+        if (callCount == 1) {
+            toolResult = calls[0].result;
+            toolNames = calls[0].name;
+        } else {
+            DynamicJsonDocument resultsDoc(1024);
+            JsonArray results = resultsDoc.to<JsonArray>();
+            for (int i = 0; i < callCount; i++) {
+                JsonObject r = results.createNestedObject();
+                r["tool"] = calls[i].name.c_str();
+                r["result"] = calls[i].result.c_str();
+                if (i > 0) toolNames += ", ";
+                toolNames += calls[i].name;
             }
+            serializeJson(resultsDoc, toolResult);
+        }
+        Serial.println("Tool Result: " + toolResult);
 
-            DynamicJsonDocument outDoc(4096);
-            outDoc["reply"] = finalTxt;
-            outDoc["thought"] = thought; // Keep original thought
-            outDoc["tool"] = tool;
-            outDoc["tool_result"] = toolResult;
-            
-            String output;
-            serializeJson(outDoc, output);
-            return output;
+        // If every tool has a local formatter the reply is built here, without a second round trip
+        String localReply;
+        bool allLocal = !forceLlm;
+        ModelRole followRole = ROLE_SUMMARIZE;
+        for (int i = 0; i < callCount; i++) {
+            if (calls[i].name.startsWith("memory_")) followRole = ROLE_MEMORY;
+        }
+        for (int i = 0; i < callCount && allLocal; i++) {
+            String part;
+            allLocal = Tools::formatResult(calls[i].name, calls[i].args, calls[i].result, part);
+            if (localReply.length()) localReply += " ";
+            localReply += part;
         }
 
-        // Return structured JSON for the Web UI (Base case or Depth > 0)
-        DynamicJsonDocument outDoc(4096);
-        outDoc["reply"] = reply;
-        outDoc["thought"] = thought;
-        outDoc["tool"] = (tool && String(tool) != "none") ? tool : "";
-        outDoc["tool_result"] = toolResult;
-        
-        String output;
-        serializeJson(outDoc, output);
-        return output;
-    } else {
-        return "{\"reply\":\"Error parsing my own thought: " + response + "\"}";
+        if (allLocal) {
+            response.reply = localReply;
+        } else {
+            // SECOND CALL (Follow-up), on the smaller model configured for this kind of turn
+            AgentResponse second = handleAgentRequest(toolResult, history, depth + 1, onToken, false, followRole);
+            response.reply = second.reply.length() ? second.reply
+                                                   : String("I executed the tool but had trouble summarizing the result.");
+        }
+
+        // Keep the original thought
+        response.tool = toolNames;
+        response.toolResult = toolResult;
+        return response;
     }
+
+    // Base case or Depth > 0: report the tool the model named, if any
+    response.tool = callCount > 0 ? calls[0].name : String();
+    return response;
+}
+
+// Parses a web chat request in place: strings stay in `body` (zero-copy), so
+// the document only holds the node tree and long histories are not cut off.
+AgentResponse handleWebRequest(String& body, TokenCallback onToken) {
+    DynamicJsonDocument doc(WEB_REQUEST_DOC_SIZE);
+    DeserializationError err = deserializeJson(doc, body.begin());
+    if (err) {
+        AgentResponse out;
+        out.reply = "Bad request: " + String(err.c_str());
+        return out;
+    }
+    if (doc.overflowed()) {
+        Serial.println("Web request: history cut to fit the parse buffer");
+    }
+    String text = doc["text"].as<String>();
+    JsonArray history = doc["history"].as<JsonArray>();
+    bool forceLlm = doc["force_llm"] | false;
+    return handleAgentRequest(text, history, 0, onToken, forceLlm);
+}
+
+// Runs one completion on the given provider for the router
+AgentResponse callProvider(ProviderRouter::Provider provider, const PromptBuilder& p, ModelRole role, TokenCallback onToken) {
+    bool followUp = role != ROLE_ROUTE;
+    if (provider == ProviderRouter::GROQ) {
+        const ModelChoice& m = config.groq_models[role];
+        Serial.println("Using Groq (" + m.model + ")...");
+        // Groq with native tools gets the tool list as a request schema, not prose
+        if (config.stream_replies) {
+            return groq->generateContentStream(p, m.model.c_str(), m.maxTokens, onToken, config.native_tools, followUp);
+        }
+        return groq->generateContent(p, m.model.c_str(), m.maxTokens, config.native_tools, followUp);
+    }
+    const ModelChoice& m = config.gemini_models[role];
+    Serial.println("Using Gemini (" + m.model + ")...");
+    return gemini->generateContent(p, m.model.c_str(), m.maxTokens, followUp);
 }
 
 void setup() {
@@ -154,20 +244,30 @@ void setup() {
     
     // Initialize File System (auto-format if failed)
     fsManager.begin();
-    if (!LittleFS.exists("/MEMORY.md")) {
-        fsManager.writeFile("/MEMORY.md", "MicroClaw Memory initialized.\n");
-    }
+    memoryStore.begin(); // Creates MEMORY.md on first boot
     
     // Initialize Config
     config.begin();
     // config.load(); // Loaded in begin()
+    memoryIndex.begin(); // Loads MEMORY.idx, or rebuilds it from MEMORY.md
+    intents.begin();     // Creates /intents.json with the default rules on first boot
+    tlsSessions.setPersistent(config.tls_session_persist);
+    scripts.setTaskConfig(config.script_core, config.script_priority);
+    scriptLibrary.begin();
+    scriptLibrary.autostart(); // Saved scripts flagged to run at boot
     
     Serial.println("Starting MicroClaw ESP32...");
 
     // Initialize components
     wifi = new WifiManager(config.wifi_ssid.c_str(), config.wifi_password.c_str(), DEVICE_HOSTNAME);
-    gemini = new GeminiClient(config.gemini_key.c_str());
-    groq = new GroqClient(config.groq_key.c_str());
+    gemini = new GeminiClient(config.gemini_key.c_str(), config.gemini_url.c_str());
+    groq = new GroqClient(config.groq_key.c_str(), config.groq_url.c_str());
+
+    // Both providers take part when keyed; with neither, Gemini reports the error as before
+    router.begin(callProvider);
+    router.setAvailable(ProviderRouter::GROQ, config.groq_key.length() > 0);
+    router.setAvailable(ProviderRouter::GEMINI, config.gemini_key.length() > 0 || config.groq_key.length() == 0);
+    router.setHedging(config.hedge_requests);
     
     // Optional Telegram
     if (config.telegram_token.length() > 0) {
@@ -178,6 +278,13 @@ void setup() {
     }
 
     tools = new Tools();
+
+    // Input rules fire saved scripts or tools straight from GPIO interrupts
+    bool rulesStarted = rules.begin([](const String& tool, JsonObject args) -> String {
+        if (!Tools::isRuleAction(tool)) return "Error: Rules cannot call " + tool;
+        return tools->execute(tool, args);
+    });
+    if (!rulesStarted) Serial.println("Rule engine failed to start");
     
     // Initialize Web Server
     webServer = new WebInterface();
@@ -185,14 +292,15 @@ void setup() {
     // Connect to WiFi First (Important for TCP Stack)
     wifi->connect();
 
-    // Bind agent logic to web server & Start
-    webServer->begin([](String body) -> String {
-        DynamicJsonDocument doc(4096);
-        deserializeJson(doc, body);
-        String text = doc["text"].as<String>();
-        JsonArray history = doc["history"].as<JsonArray>();
-        return handleAgentRequest(text, history);
+    // Agent requests run on their own task; loop() only queues and collects them.
+    // The response is serialized once, here, for whichever frontend asked.
+    bool workerStarted = agentWorker.begin([](AgentJob& job, TokenCallback onToken) -> String {
+        if (job.source == AgentJob::TELEGRAM) return handleAgentRequest(job.body).toJson();
+        return handleWebRequest(job.body, onToken).toJson();
     });
+    if (!workerStarted) Serial.println("Agent worker failed to start");
+
+    webServer->begin();
 
     Serial.println("Ready! CLI available.");
     if (config.telegram_token.length() > 0) Serial.println("Chat via Telegram.");
@@ -215,14 +323,17 @@ void loop() {
     if (bot && wifi->isConnected()) {
         TelegramBot::Message msg;
         if (bot->getNewMessage(msg)) {
-            // Notify user we are thinking
-            bot->sendMessage(msg.chatId, "Thinking...");
-            
-            // Process Request
-            String reply = handleAgentRequest(msg.text);
-            
-            // Send Reply
-            bot->sendMessage(msg.chatId, reply);
+            // Queue the request; the reply is sent below once the worker is done
+            if (agentWorker.submit(AgentJob::TELEGRAM, msg.text, msg.chatId)) {
+                bot->sendMessage(msg.chatId, "Thinking...");
+            } else {
+                bot->sendMessage(msg.chatId, "I'm busy with other requests, please try again in a moment.");
+            }
+        }
+
+        String chatId, reply;
+        while (agentWorker.takeTelegramReply(chatId, reply)) {
+            bot->sendMessage(chatId, reply);
         }
     }
     
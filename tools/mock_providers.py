@@ -0,0 +1,274 @@
+"""Local stand-ins for the Groq and Gemini APIs, to exercise the provider
+router (failover, circuit breaker, hedging) on a real device.
+
+Both servers answer in the providers' wire formats (Groq JSON and SSE,
+Gemini generateContent) and can be told to fail or to answer late. Point the
+device at them from its serial console, then run the checks against its web
+API:
+
+    set_provider groq
+    set_api_key x            (any non-empty keys: both providers available)
+    set_groq_key x
+    set_groq_url http://<this host>:8301/openai/v1/chat/completions
+    set_gemini_url http://<this host>:8302/v1beta/models/
+    set_hedging on
+    restart
+
+    python tools/mock_providers.py --device http://<device ip>
+
+Without --device the servers just run, in the modes given by --groq and
+--gemini, for manual testing; provider_stats on the console shows what the
+router made of it.
+"""
+import argparse
+import json
+import socket
+import sys
+import threading
+import time
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+BREAKER_FAILS = 3          # ROUTER_BREAKER_FAILS
+COOLDOWN_S = 15            # ROUTER_COOLDOWN_MS
+HEDGE_MAX_S = 10           # ROUTER_HEDGE_MAX_MS: later than this always hedges
+SLOW_S = 14                # Primary delay in the hedging checks
+JOB_TIMEOUT_S = 60
+
+
+class Provider:
+    """Behaviour and request log of one mock provider."""
+
+    def __init__(self, name):
+        self.name = name
+        self.lock = threading.Lock()
+        self.mode = "ok"       # "ok" or "fail"
+        self.delay = 0.0
+        self.received = 0      # Requests that reached the server
+        self.answered = 0      # Successful answers fully written to the socket
+
+    def set(self, mode="ok", delay=0.0):
+        with self.lock:
+            self.mode = mode
+            self.delay = delay
+
+    def counts(self):
+        with self.lock:
+            return self.received, self.answered
+
+    def reply(self):
+        # The device parses the text as its {"thought", "reply"} format
+        return json.dumps({"thought": "mock", "reply": "from " + self.name})
+
+
+def make_handler(provider, shape):
+    class Handler(BaseHTTPRequestHandler):
+        protocol_version = "HTTP/1.1"  # Keep-alive, as the device pools connections
+
+        def log_message(self, fmt, *args):
+            pass
+
+        def do_POST(self):
+            body = self.rfile.read(int(self.headers.get("Content-Length", 0)))
+            with provider.lock:
+                provider.received += 1
+                mode, delay = provider.mode, provider.delay
+            log(f"{provider.name}: request ({mode}, {delay:g}s)")
+            if delay:
+                time.sleep(delay)
+            try:
+                if mode == "fail":
+                    self.send(500, "application/json", b'{"error":{"message":"mock failure"}}')
+                    return
+                if shape == "groq":
+                    stream = json.loads(body or b"{}").get("stream", False)
+                    if stream:
+                        self.send_stream(provider.reply())
+                    else:
+                        self.send(200, "application/json", json.dumps(
+                            {"choices": [{"message": {"role": "assistant", "content": provider.reply()}}]}).encode())
+                else:
+                    self.send(200, "application/json", json.dumps(
+                        {"candidates": [{"content": {"parts": [{"text": provider.reply()}]}}]}).encode())
+            except OSError as e:
+                log(f"{provider.name}: client gone before the answer ({e})")
+                return
+            with provider.lock:
+                provider.answered += 1
+            log(f"{provider.name}: answered")
+
+        def send(self, code, content_type, payload):
+            self.send_response(code)
+            self.send_header("Content-Type", content_type)
+            self.send_header("Content-Length", str(len(payload)))
+            self.end_headers()
+            self.wfile.write(payload)
+            self.wfile.flush()
+
+        def send_stream(self, text):
+            self.send_response(200)
+            self.send_header("Content-Type", "text/event-stream")
+            self.send_header("Transfer-Encoding", "chunked")
+            self.end_headers()
+            for i in range(0, len(text), 8):
+                chunk = {"choices": [{"delta": {"content": text[i:i + 8]}}]}
+                self.write_chunk(f"data: {json.dumps(chunk)}\n\n".encode())
+            self.write_chunk(b"data: [DONE]\n\n")
+            self.write_chunk(b"")
+
+        def write_chunk(self, data):
+            self.wfile.write(f"{len(data):x}\r\n".encode() + data + b"\r\n")
+            self.wfile.flush()
+
+    return Handler
+
+
+def serve(provider, shape, port):
+    server = ThreadingHTTPServer(("0.0.0.0", port), make_handler(provider, shape))
+    server.daemon_threads = True
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+    return server
+
+
+def log(message):
+    print(time.strftime("%H:%M:%S"), message, flush=True)
+
+
+def local_ip():
+    s = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    try:
+        s.connect(("10.255.255.255", 1))
+        return s.getsockname()[0]
+    except OSError:
+        return "127.0.0.1"
+    finally:
+        s.close()
+
+
+def chat(device, text):
+    """Sends a message through /api/chat and waits for the job. Returns
+    (reply, seconds)."""
+    start = time.time()
+    req = urllib.request.Request(device + "/api/chat", data=json.dumps({"text": text, "history": []}).encode(),
+                                 headers={"Content-Type": "application/json"})
+    with urllib.request.urlopen(req, timeout=10) as res:
+        job = json.load(res)["job"]
+    while time.time() - start < JOB_TIMEOUT_S:
+        with urllib.request.urlopen(f"{device}/api/job?id={job}&since=0", timeout=10) as res:
+            status = json.load(res)
+        if status["status"] == "done":
+            result = status.get("result") or {}
+            return result.get("reply", ""), time.time() - start
+        time.sleep(0.25)
+    raise TimeoutError(f"job {job} not done after {JOB_TIMEOUT_S}s")
+
+
+def wait_until(condition, timeout):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        if condition():
+            return True
+        time.sleep(0.25)
+    return False
+
+
+def check_hedge_wins(device, groq, gemini):
+    """Primary too slow: the hedge to the secondary answers first."""
+    groq.set("ok", SLOW_S)
+    gemini.set("ok")
+    reply, seconds = chat(device, "mock check: hedge")
+    ok = "from gemini" in reply and seconds < SLOW_S
+    wait_until(lambda: groq.counts()[1] >= groq.counts()[0], SLOW_S + 5)  # Let the slow one finish
+    return ok, f"reply {reply!r} after {seconds:.1f}s (groq delayed {SLOW_S}s)"
+
+
+def check_straggler(device, groq, gemini):
+    """The losing attempt completes after the caller has returned, and the
+    device carries on serving requests."""
+    groq.set("ok", SLOW_S)
+    gemini.set("ok")
+    _, answered_before = groq.counts()
+    reply, seconds = chat(device, "mock check: straggler")
+    if "from gemini" not in reply:
+        return False, f"hedged reply expected, got {reply!r}"
+    returned_first = groq.counts()[1] == answered_before
+    finished = wait_until(lambda: groq.counts()[1] > answered_before, SLOW_S + 5)
+    time.sleep(2)  # Give the straggler task time to record and clean up
+    groq.set("ok")
+    after, _ = chat(device, "mock check: after straggler")
+    ok = returned_first and finished and "from groq" in after
+    return ok, (f"returned after {seconds:.1f}s before groq answered: {returned_first}, "
+                f"groq answered later: {finished}, next reply {after!r}")
+
+
+def check_breaker_opens(device, groq, gemini):
+    """BREAKER_FAILS failures in a row open groq's breaker: requests fail
+    over to gemini, then stop reaching groq until the cooldown is over."""
+    groq.set("fail")
+    gemini.set("ok")
+    for i in range(BREAKER_FAILS):
+        reply, _ = chat(device, f"mock check: breaker {i + 1}")
+        if "from gemini" not in reply:
+            return False, f"failover reply expected, got {reply!r}"
+    received, _ = groq.counts()
+    reply, _ = chat(device, "mock check: breaker open")
+    skipped = groq.counts()[0] == received and "from gemini" in reply
+
+    # After the cooldown one probe goes through and closes it again
+    groq.set("ok")
+    time.sleep(COOLDOWN_S + 1)
+    probe, _ = chat(device, "mock check: breaker probe")
+    ok = skipped and "from groq" in probe
+    return ok, f"groq skipped while open: {skipped}, probe reply after cooldown {probe!r}"
+
+
+CHECKS = [
+    ("hedge wins", check_hedge_wins),
+    ("straggler finishes after the caller", check_straggler),
+    ("breaker opens", check_breaker_opens),
+]
+
+
+def main():
+    parser = argparse.ArgumentParser(description="Mock Groq/Gemini servers for provider router checks")
+    parser.add_argument("--device", help="Device base URL, e.g. http://192.168.1.50; runs the checks")
+    parser.add_argument("--groq-port", type=int, default=8301)
+    parser.add_argument("--gemini-port", type=int, default=8302)
+    parser.add_argument("--groq", default="ok", help="Serve-only mode: ok, fail or a delay in seconds")
+    parser.add_argument("--gemini", default="ok", help="Serve-only mode: ok, fail or a delay in seconds")
+    args = parser.parse_args()
+
+    groq, gemini = Provider("groq"), Provider("gemini")
+    serve(groq, "groq", args.groq_port)
+    serve(gemini, "gemini", args.gemini_port)
+    host = local_ip()
+    log(f"groq:   http://{host}:{args.groq_port}/openai/v1/chat/completions")
+    log(f"gemini: http://{host}:{args.gemini_port}/v1beta/models/")
+
+    if not args.device:
+        for provider, mode in ((groq, args.groq), (gemini, args.gemini)):
+            provider.set("fail") if mode == "fail" else provider.set("ok", 0 if mode == "ok" else float(mode))
+        try:
+            while True:
+                time.sleep(1)
+        except KeyboardInterrupt:
+            return 0
+
+    device = args.device.rstrip("/")
+    groq.set("ok")
+    gemini.set("ok")
+    reply, _ = chat(device, "mock check: warm up")
+    if "from groq" not in reply:
+        log(f"Device did not answer from the groq mock ({reply!r}); check the setup in this script's header")
+        return 1
+
+    failed = 0
+    for name, check in CHECKS:
+        ok, detail = check(device, groq, gemini)
+        log(f"{'PASS' if ok else 'FAIL'} {name}: {detail}")
+        failed += not ok
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())